@@ -1,10 +1,50 @@
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L /* open(), fstat(), mmap() are hidden by -ansi otherwise */
+#endif
+
 #include "milo.h"
 #include <assert.h>  /* assert() */
 #include <errno.h>   /* errno, ERANGE */
-#include <math.h>    /* HUGE_VAL */
-#include <stdio.h>   /* sprintf() */
+#include <limits.h>  /* UINT_MAX */
+#include <math.h>    /* HUGE_VAL, floor() */
+#include <stdio.h>   /* sprintf(), fopen(), fwrite(), fread() */
 #include <stdlib.h> #include <stdlib.h>  /* NULL, malloc(), realloc(), free(), strtod() */
-#include <string.h>  /* memcpy() */
+#include <string.h>  /* memcpy(), memset(), memcmp() */
+
+/* The string scanner reads whole aligned blocks past the terminator, which AddressSanitizer reports */
+#if defined(__SANITIZE_ADDRESS__) && !defined(MILO_NO_SIMD)
+#define MILO_NO_SIMD
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) && !defined(MILO_NO_SIMD)
+#define MILO_NO_SIMD
+#endif
+#endif
+
+#if !defined(MILO_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MILO_SSE2
+#include <emmintrin.h> /* SSE2 intrinsics */
+#if defined(__SSSE3__) || defined(__AVX__)
+#define MILO_SSSE3
+#include <tmmintrin.h> /* SSSE3 intrinsics */
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> /* Interlocked*() */
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MILO_POSIX
+#include <fcntl.h>     /* open() */
+#include <sys/mman.h>  /* mmap(), munmap() */
+#include <sys/stat.h>  /* fstat() */
+#include <unistd.h>    /* close() */
+#include <sched.h>     /* sched_yield() */
+#include <sys/uio.h>   /* struct iovec */
+#include <pthread.h>   /* pthread_create(), pthread_mutex_lock(), pthread_cond_wait() */
+#endif
 
 #ifndef MILO_PARSE_STACK_INIT_SIZE
 #define MILO_PARSE_STACK_INIT_SIZE 256
@@ -14,18 +54,54 @@
 #define MILO_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
 
+#ifndef MILO_RECLAIM_QUEUE_SIZE
+#define MILO_RECLAIM_QUEUE_SIZE 64 /* trees waiting for the reclaimer; beyond that callers wait */
+#endif
+
+#ifndef MILO_STRINGIFY_IOV_MIN_REF
+#define MILO_STRINGIFY_IOV_MIN_REF 256 /* shorter runs are cheaper to copy than to give their own iovec */
+#endif
+
 #define EXPECT(c, ch)      do { assert(*c->json == (ch)); c->json++;} while(0)
 #define ISDIGHT(ch) ((ch) >= '0' && (ch) <= '9')
 #define ISDIGIT1TO9(ch)     ((ch) >= '1' && (ch) <= '9')
+
+/* Counts live in the union, or next to it in the compact layout */
+#ifdef MILO_COMPACT
+#define MILO_OSIZE(v) ((v)->size)
+#define MILO_ASIZE(v) ((v)->size)
+#define MILO_SLEN(v)  ((v)->size)
+#ifndef MILO_COMPACT_SIZE_MAX
+#define MILO_COMPACT_SIZE_MAX UINT_MAX
+#endif
+#define MILO_SIZE_FITS(n) ((n) <= MILO_COMPACT_SIZE_MAX)
+#else
+#define MILO_SIZE_FITS(n) 1
+#define MILO_OSIZE(v) ((v)->u.o.size)
+#define MILO_ASIZE(v) ((v)->u.a.size)
+#define MILO_SLEN(v)  ((v)->u.s.len)
+#endif
 #define PUTC(c, ch) do { *(char*)milo_context_push(c, sizeof(char)) = (ch); } while(0)
 #define PUTS(c, s, len)     memcpy(milo_context_push(c, len), s, len)
+#define WRITEC(c, ch)       do { char ch_ = (ch); milo_context_write(c, &ch_, 1); } while(0)
+#define WRITES(c, s, len)   milo_context_write(c, s, len)
 
 typedef struct {
     const char* json;
     char* stack;
     size_t size, top;
+    unsigned flags;
+    int output; /* MILO_OUTPUT_*, for stringify */
+#ifdef MILO_POSIX
+    struct iovec* iov; /* MILO_OUTPUT_IOV: entries so far, capacity, start of the open scratch run */
+    size_t iovcnt, iovmax, seg;
+#endif
 } milo_context;
 
+#define MILO_OUTPUT_DYNAMIC 0 /* stack grows as needed */
+#define MILO_OUTPUT_FIXED   1 /* stack is a caller-owned buffer of size bytes that is never grown */
+#define MILO_OUTPUT_IOV     2 /* stack is scratch space; long clean strings are referenced in iov */
+
 static void* milo_context_push(milo_context* c, size_t size) {
     void* ret;
     assert(size > 0);
@@ -41,6 +117,18 @@ static void* milo_context_push(milo_context* c, size_t size) {
     return ret;
 }
 
+/* In fixed mode output beyond the buffer is dropped but still counted in top. */
+static void milo_context_write(milo_context* c, const char* s, size_t len) {
+    if (c->output != MILO_OUTPUT_FIXED) {
+        if (len > 0)
+            memcpy(milo_context_push(c, len), s, len);
+        return;
+    }
+    if (c->top + len <= c->size)
+        memcpy(c->stack + c->top, s, len);
+    c->top += len;
+}
+
 static void* milo_context_pop(milo_context* c, size_t size) {
     assert(c->top >= size);
     return c->stack + (c->top -= size);
@@ -66,29 +154,84 @@ static int milo_parse_literal(milo_context* c, milo_value* v, const char* litera
     return MILO_PARSE_OK;
 }
 
-static int milo_parse_number(milo_context *c, milo_value *v) {
-    const char* p = c->json;
+#define MILO_NUMBER_LAZY    1 /* u.l holds the source lexeme */
+#define MILO_NUMBER_DECODED 2 /* u.l.n holds the decoded lexeme (never set in the compact layout) */
+#define MILO_NUMBER_INTEGER 4 /* lexeme has neither fraction nor exponent */
+
+#define MILO_ARRAY_PACKED   1 /* u.d.n holds the elements as doubles */
+
+/*
+ * Returns the end of the number lexeme at p, or NULL if it is malformed.
+ * hint receives MILO_NUMBER_INTEGER for plain integers and safe tells whether
+ * the magnitude stays below 10^308, so that strtod() cannot overflow.
+ */
+static const char* milo_scan_number(const char* p, unsigned* hint, int* safe) {
+    const char* q;
+    long digits, exp = 0;
+    *hint = MILO_NUMBER_INTEGER;
     if (*p == '-') p++;
+    q = p;
     if (*p == '0') p++;
     else {
-        if (!ISDIGIT1TO9(*p)) return MILO_PARSE_INVALID_VALUE;
+        if (!ISDIGIT1TO9(*p)) return NULL;
         for(p++;ISDIGHT(*p);p++);
     }
+    digits = (long)(p - q);
     if (*p == '.') {
         p++;
-        if (!ISDIGHT(*p)) return MILO_PARSE_INVALID_VALUE;
+        if (!ISDIGHT(*p)) return NULL;
         for(++p;ISDIGHT(*p);p++);
+        *hint = 0;
     }
     if (*p == 'e' || *p == 'E') {
+        int negative;
         p++;
+        negative = *p == '-';
         if (*p == '+' || *p =='-') p++;
-        if (!ISDIGHT(*p)) return MILO_PARSE_INVALID_VALUE;
-        for(++p;ISDIGHT(*p);p++);
+        if (!ISDIGHT(*p)) return NULL;
+        for(;ISDIGHT(*p);p++)
+            if (exp < 100000)
+                exp = exp * 10 + (*p - '0');
+        if (negative)
+            exp = 0; /* underflow is not an error */
+        *hint = 0;
+    }
+    *safe = digits + exp <= 308;
+    return p;
+}
+
+/* Integers of up to 15 digits are exact in a double, which saves strtod(). */
+static double milo_decode_lexeme(const char* p, unsigned flags) {
+    const char* q = p + (*p == '-');
+    double n = 0.0;
+    if (flags & MILO_NUMBER_INTEGER) {
+        const char* d;
+        for (d = q; ISDIGHT(*d) && d - q < 16; d++)
+            n = n * 10.0 + (*d - '0');
+        if (d - q < 16)
+            return *p == '-' ? -n : n;
+    }
+    return strtod(p, NULL);
+}
+
+static int milo_parse_number(milo_context *c, milo_value *v) {
+    unsigned hint;
+    int safe;
+    const char* p = milo_scan_number(c->json, &hint, &safe);
+    if (p == NULL)
+        return MILO_PARSE_INVALID_VALUE;
+    if ((c->flags & MILO_PARSE_OPT_LAZY_NUMBERS) && safe) {
+        v->u.l.p = c->json;
+        v->flags = MILO_NUMBER_LAZY | hint;
+        v->type = MILO_NUMBER;
+        c->json = p;
+        return MILO_PARSE_OK;
     }
     errno = 0;
     v->u.n = strtod(c->json, NULL);
     if (errno == ERANGE && (v->u.n == HUGE_VAL || v->u.n == -HUGE_VAL))
         return MILO_PARSE_NUMBER_TOO_BIG;
+    v->flags = 0;
     v->type = MILO_NUMBER;
     c->json = p;
     return MILO_PARSE_OK;
@@ -129,16 +272,201 @@ static void milo_encode_utf8(milo_context* c, unsigned u) {
     }
 }
 
+/* Bytes that end a run of plain string characters: '"', '\\', controls and, when high is set, non-ASCII */
+#define MILO_STRING_SPECIAL(ch, high) \
+    ((unsigned char)(ch) < 0x20 || (ch) == '\"' || (ch) == '\\' || ((high) && (unsigned char)(ch) >= 0x80))
+
+#ifdef MILO_SSE2
+static int milo_ctz(unsigned mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int n = 0;
+    assert(mask != 0);
+    while (!(mask & 1)) {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static unsigned milo_sse2_special_mask(__m128i x, int high) {
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(x, control), control)); /* x <= 0x1F */
+    return (unsigned)_mm_movemask_epi8(m) | (high ? (unsigned)_mm_movemask_epi8(x) : 0u);
+}
+#endif
+
+/* Finds the first special byte at or after p in a null-terminated string. */
+static const char* milo_scan_string(const char* p, int high) {
+#ifdef MILO_SSE2
+    /* Align first so that 16-byte loads never cross into an unmapped page */
+    for (; ((size_t)p & 15) != 0; p++)
+        if (MILO_STRING_SPECIAL(*p, high))
+            return p;
+    for (;; p += 16) {
+        unsigned mask = milo_sse2_special_mask(_mm_load_si128((const __m128i*)p), high);
+        if (mask != 0)
+            return p + milo_ctz(mask);
+    }
+#else
+    while (!MILO_STRING_SPECIAL(*p, high))
+        p++;
+    return p;
+#endif
+}
+
+/* Finds the first special byte in [p, end), or end. */
+static const char* milo_scan_string_n(const char* p, const char* end, int high) {
+#ifdef MILO_SSE2
+    for (; end - p >= 16; p += 16) {
+        unsigned mask = milo_sse2_special_mask(_mm_loadu_si128((const __m128i*)p), high);
+        if (mask != 0)
+            return p + milo_ctz(mask);
+    }
+#endif
+    while (p != end && !MILO_STRING_SPECIAL(*p, high))
+        p++;
+    return p;
+}
+
+/* Validates one UTF-8 sequence starting at a byte >= 0x80, returns the byte after it or NULL. */
+static const char* milo_validate_utf8(const char* s) {
+    const unsigned char* p = (const unsigned char*)s;
+    unsigned u;
+    int i, n;
+    if      (p[0] >= 0xC2 && p[0] <= 0xDF) { n = 1; u = p[0] & 0x1F; }
+    else if (p[0] >= 0xE0 && p[0] <= 0xEF) { n = 2; u = p[0] & 0x0F; }
+    else if (p[0] >= 0xF0 && p[0] <= 0xF4) { n = 3; u = p[0] & 0x07; }
+    else return NULL;
+    for (i = 1; i <= n; i++) {
+        if ((p[i] & 0xC0) != 0x80)
+            return NULL;
+        u = (u << 6) | (p[i] & 0x3F);
+    }
+    if (n == 2 && (u < 0x800 || (u >= 0xD800 && u <= 0xDFFF))) /* overlong or surrogate */
+        return NULL;
+    if (n == 3 && (u < 0x10000 || u > 0x10FFFF))
+        return NULL;
+    return s + n + 1;
+}
+
+#ifdef MILO_SSSE3
+/*
+ * Lookup-table UTF-8 check (Keiser and Lemire): every byte is classified by
+ * the high nibble of its predecessor, the low nibble of its predecessor and
+ * its own high nibble, and an error is any bit left set in all three.
+ */
+#define MILO_U8_TOO_SHORT  0x01 /* lead or ASCII followed by a lead or ASCII */
+#define MILO_U8_TOO_LONG   0x02 /* ASCII followed by a continuation */
+#define MILO_U8_OVERLONG_3 0x04 /* E0 80..9F */
+#define MILO_U8_TOO_LARGE  0x08 /* F4 90..BF, F5..FF */
+#define MILO_U8_SURROGATE  0x10 /* ED A0..BF */
+#define MILO_U8_OVERLONG_2 0x20 /* C0..C1 */
+#define MILO_U8_LARGE_1000 0x40 /* F5..FF 80..8F */
+#define MILO_U8_OVERLONG_4 0x40 /* F0 80..8F */
+#define MILO_U8_TWO_CONTS  0x80 /* continuation followed by a continuation */
+#define MILO_U8_CARRY (MILO_U8_TOO_SHORT | MILO_U8_TOO_LONG | MILO_U8_TWO_CONTS)
+
+static __m128i milo_ssse3_utf8_errors(__m128i x, __m128i prev) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte1_high = _mm_setr_epi8(
+        MILO_U8_TOO_LONG, MILO_U8_TOO_LONG, MILO_U8_TOO_LONG, MILO_U8_TOO_LONG,
+        MILO_U8_TOO_LONG, MILO_U8_TOO_LONG, MILO_U8_TOO_LONG, MILO_U8_TOO_LONG,
+        (char)MILO_U8_TWO_CONTS, (char)MILO_U8_TWO_CONTS, (char)MILO_U8_TWO_CONTS, (char)MILO_U8_TWO_CONTS,
+        MILO_U8_TOO_SHORT | MILO_U8_OVERLONG_2,
+        MILO_U8_TOO_SHORT,
+        MILO_U8_TOO_SHORT | MILO_U8_OVERLONG_3 | MILO_U8_SURROGATE,
+        (char)(MILO_U8_TOO_SHORT | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000 | MILO_U8_OVERLONG_4));
+    const __m128i byte1_low = _mm_setr_epi8(
+        (char)(MILO_U8_CARRY | MILO_U8_OVERLONG_3 | MILO_U8_OVERLONG_2 | MILO_U8_OVERLONG_4),
+        (char)(MILO_U8_CARRY | MILO_U8_OVERLONG_2),
+        (char)MILO_U8_CARRY, (char)MILO_U8_CARRY,
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000 | MILO_U8_SURROGATE),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000),
+        (char)(MILO_U8_CARRY | MILO_U8_TOO_LARGE | MILO_U8_LARGE_1000));
+    const __m128i byte2_high = _mm_setr_epi8(
+        MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT,
+        MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT,
+        (char)(MILO_U8_TOO_LONG | MILO_U8_OVERLONG_2 | MILO_U8_TWO_CONTS | MILO_U8_OVERLONG_3 | MILO_U8_LARGE_1000 | MILO_U8_OVERLONG_4),
+        (char)(MILO_U8_TOO_LONG | MILO_U8_OVERLONG_2 | MILO_U8_TWO_CONTS | MILO_U8_OVERLONG_3 | MILO_U8_TOO_LARGE),
+        (char)(MILO_U8_TOO_LONG | MILO_U8_OVERLONG_2 | MILO_U8_TWO_CONTS | MILO_U8_SURROGATE | MILO_U8_TOO_LARGE),
+        (char)(MILO_U8_TOO_LONG | MILO_U8_OVERLONG_2 | MILO_U8_TWO_CONTS | MILO_U8_SURROGATE | MILO_U8_TOO_LARGE),
+        MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT, MILO_U8_TOO_SHORT);
+    __m128i prev1 = _mm_alignr_epi8(x, prev, 15);
+    __m128i sc = _mm_and_si128(
+        _mm_and_si128(_mm_shuffle_epi8(byte1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(byte1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte2_high, _mm_and_si128(_mm_srli_epi16(x, 4), nibble)));
+    /* the third and fourth bytes of a sequence must be continuations, and only they may follow one */
+    __m128i must23 = _mm_or_si128(
+        _mm_subs_epu8(_mm_alignr_epi8(x, prev, 14), _mm_set1_epi8((char)(0xE0 - 0x80))),
+        _mm_subs_epu8(_mm_alignr_epi8(x, prev, 13), _mm_set1_epi8((char)(0xF0 - 0x80))));
+    return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char)0x80)), sc);
+}
+
+/*
+ * Skips the well-formed UTF-8 in whole 16-byte blocks from s, which starts a
+ * character, up to the first block holding an error or a '"', '\\' or
+ * control byte.  Returns where the scalar check must resume: a character
+ * boundary at or after s.  Without end, a block is only loaded when it starts
+ * inside the string and does not cross a page boundary.
+ */
+static const char* milo_skip_utf8(const char* s, const char* end) {
+    const char* p = s;
+    __m128i prev = _mm_setzero_si128();
+    for (; end != NULL ? end - p >= 16 : ((size_t)p & 4095) <= 4096 - 16; p += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        if (milo_sse2_special_mask(x, 0) != 0 ||
+            _mm_movemask_epi8(_mm_cmpeq_epi8(milo_ssse3_utf8_errors(x, prev), _mm_setzero_si128())) != 0xFFFF)
+            break;
+        prev = x;
+    }
+    /* a sequence at the end of the last block may continue beyond it */
+    if (p != s) {
+        const unsigned char* u = (const unsigned char*)p;
+        if (u[-1] >= 0xC0)
+            p -= 1;
+        else if (u[-2] >= 0xE0)
+            p -= 2;
+        else if (u[-3] >= 0xF0)
+            p -= 3;
+    }
+    return p;
+}
+#else
+#define milo_skip_utf8(s, end) (s)
+#endif
+
 #define STRING_ERROR(ret) do { c->top = head; return ret; } while(0)
 
 static int milo_parse_string_raw(milo_context* c, char** str, size_t* len) {
     size_t head = c->top;
     unsigned u, u2;
-    const char* p;
+    const char* p, *q;
+    int validate = (c->flags & MILO_PARSE_OPT_VALIDATE_UTF8) != 0;
     EXPECT(c, '\"');
     p = c->json;
     for (;;) {
-        char ch = *p++;
+        char ch;
+        if ((q = milo_scan_string(p, validate)) != p) {
+            PUTS(c, p, q - p);
+            p = q;
+        }
+        ch = *p++;
         switch (ch) {
             case '\"':
                 *len = c->top - head;
@@ -180,7 +508,12 @@ static int milo_parse_string_raw(milo_context* c, char** str, size_t* len) {
             default:
                 if ((unsigned char)ch < 0x20)
                     STRING_ERROR(MILO_PARSE_INVALID_STRING_CHAR);
-                PUTC(c, ch);
+                /* Only non-ASCII bytes in validating mode get here */
+                q = --p;
+                while ((unsigned char)*(p = milo_skip_utf8(p, NULL)) >= 0x80)
+                    if (!(p = milo_validate_utf8(p)))
+                        STRING_ERROR(MILO_PARSE_INVALID_UTF8);
+                PUTS(c, q, p - q);
         }
     }
 }
@@ -189,28 +522,142 @@ static int milo_parse_string(milo_context* c, milo_value* v) {
     int ret;
     char* s;
     size_t len;
-    if ((ret = milo_parse_string_raw(c, &s, &len)) == MILO_PARSE_OK)
+    if ((ret = milo_parse_string_raw(c, &s, &len)) != MILO_PARSE_OK)
+        return ret;
+    if (!MILO_SIZE_FITS(len))
+        return MILO_PARSE_SIZE_TOO_BIG;
+    if (v->type == MILO_STRING) { /* recycled */
+        memcpy(v->u.s.s = (char*)realloc(v->u.s.s, len + 1), s, len);
+        v->u.s.s[len] = '\0';
+        MILO_SLEN(v) = len;
+    }
+    else
         milo_set_string(v, s, len);
     return ret;
 }
 
 static int milo_parse_value(milo_context *c, milo_value *v); /* forward declaration */
+static void milo_free_value(milo_value* v); /* forward declaration */
+
+/* Free the donor elements or members [from, to) that were not reparsed */
+static void milo_free_elements(milo_value* e, size_t from, size_t to) {
+    for (; from < to; from++)
+        milo_free_value(&e[from]);
+}
+
+static void milo_free_members(milo_member* m, size_t from, size_t to) {
+    for (; from < to; from++) {
+        free(m[from].k);
+        milo_free_value(&m[from].v);
+    }
+}
+
+/*
+ * Parses leading number elements into a block of doubles on the stack, until
+ * the array ends (*closed is set) or an element that is not a number starts.
+ */
+static int milo_parse_packed(milo_context* c, size_t* size, int* closed) {
+    *closed = 0;
+    while (*c->json == '-' || ISDIGHT(*c->json)) {
+        unsigned hint;
+        int safe;
+        double n;
+        const char* p = milo_scan_number(c->json, &hint, &safe);
+        if (p == NULL)
+            return MILO_PARSE_INVALID_VALUE;
+        if (safe)
+            n = milo_decode_lexeme(c->json, hint);
+        else {
+            errno = 0;
+            n = strtod(c->json, NULL);
+            if (errno == ERANGE && (n == HUGE_VAL || n == -HUGE_VAL))
+                return MILO_PARSE_NUMBER_TOO_BIG;
+        }
+        memcpy(milo_context_push(c, sizeof(double)), &n, sizeof(double));
+        (*size)++;
+        c->json = p;
+        milo_parse_whitespace(c);
+        if (*c->json == ',') {
+            c->json++;
+            milo_parse_whitespace(c);
+        }
+        else if (*c->json == ']') {
+            c->json++;
+            *closed = 1;
+            break;
+        }
+        else
+            return MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+    }
+    return MILO_PARSE_OK;
+}
+
+/* Turns the top size doubles on the stack into number values */
+static void milo_unpack_stack(milo_context* c, size_t size) {
+    size_t i;
+    double* n;
+    if (size == 0)
+        return;
+    n = (double*)malloc(size * sizeof(double));
+    memcpy(n, milo_context_pop(c, size * sizeof(double)), size * sizeof(double));
+    for (i = 0; i < size; i++) {
+        milo_value e;
+        milo_init(&e);
+        e.u.n = n[i];
+        e.flags = 0;
+        e.type = MILO_NUMBER;
+        memcpy(milo_context_push(c, sizeof(milo_value)), &e, sizeof(milo_value));
+    }
+    free(n);
+}
 
 static int milo_parse_array(milo_context* c, milo_value* v) {
-    size_t i, size = 0;
-    int ret;
+    size_t i, size = 0, used = 0, reuse = 0;
+    milo_value* old = NULL;
+    int ret = MILO_PARSE_OK;
     EXPECT(c, '[');
+    if (v->type == MILO_ARRAY && (v->flags & MILO_ARRAY_PACKED))
+        milo_free_value(v); /* a packed block has no elements to reparse */
+    if (v->type == MILO_ARRAY) { /* recycled: old elements are reparsed in order and the block resized */
+        old = v->u.a.e;
+        reuse = MILO_ASIZE(v);
+        v->type = MILO_NULL;
+    }
     milo_parse_whitespace(c);
     if (*c->json == ']') {
         c->json++;
+        milo_free_elements(old, 0, reuse);
+        free(old);
         v->type = MILO_ARRAY;
-        v->u.a.size = 0;
+        v->flags = 0;
+        MILO_ASIZE(v) = 0;
         v->u.a.e = NULL;
         return MILO_PARSE_OK;
     }
-    for(;;) {
+    if (c->flags & MILO_PARSE_OPT_PACK_NUMBERS) {
+        int closed;
+        if ((ret = milo_parse_packed(c, &size, &closed)) == MILO_PARSE_OK && closed && !MILO_SIZE_FITS(size)) {
+            milo_context_pop(c, size * sizeof(double));
+            size = 0;
+            ret = MILO_PARSE_SIZE_TOO_BIG;
+        }
+        if (ret == MILO_PARSE_OK && closed) {
+            milo_free_elements(old, 0, reuse);
+            v->type = MILO_ARRAY;
+            v->flags = MILO_ARRAY_PACKED;
+            MILO_ASIZE(v) = size;
+            size *= sizeof(double);
+            memcpy(v->u.d.n = (double*)realloc(old, size), milo_context_pop(c, size), size);
+            return MILO_PARSE_OK;
+        }
+        milo_unpack_stack(c, size); /* mixed array or error: continue with regular elements */
+    }
+    while (ret == MILO_PARSE_OK) {
         milo_value e;
-        milo_init(&e);
+        if (used < reuse)
+            e = old[used++];
+        else
+            milo_init(&e);
         if ((ret = milo_parse_value(c, &e)) != MILO_PARSE_OK)
             break;
         memcpy(milo_context_push(c, sizeof(milo_value)), &e, sizeof(milo_value));
@@ -220,12 +667,18 @@ static int milo_parse_array(milo_context* c, milo_value* v) {
             c->json++;
             milo_parse_whitespace(c);
         }
+        else if (*c->json == ']' && !MILO_SIZE_FITS(size)) {
+            ret = MILO_PARSE_SIZE_TOO_BIG;
+            break;
+        }
         else if (*c->json == ']') {
             c->json++;
+            milo_free_elements(old, used, reuse);
             v->type = MILO_ARRAY;
-            v->u.a.size = size;
+            v->flags = 0;
+            MILO_ASIZE(v) = size;
             size *= sizeof(milo_value);
-            memcpy(v->u.a.e = (milo_value*)malloc(size), milo_context_pop(c, size), size);
+            memcpy(v->u.a.e = (milo_value*)realloc(old, size), milo_context_pop(c, size), size);
             return MILO_PARSE_OK;
         }
         else {
@@ -236,27 +689,40 @@ static int milo_parse_array(milo_context* c, milo_value* v) {
     /* Pop and free values on the stack */
     for (i = 0; i < size; i++)
         milo_free((milo_value*)milo_context_pop(c, sizeof(milo_value)));
+    milo_free_elements(old, used, reuse);
+    free(old);
     return ret;
 }
 
 static int milo_parse_object(milo_context* c, milo_value* v) {
-    size_t i, size;
-    milo_member m;
+    size_t i, size, used = 0, reuse = 0;
+    milo_member m, *old = NULL;
     int ret;
     EXPECT(c, '{');
+    if (v->type == MILO_OBJECT) { /* recycled: old keys and values are reparsed in order */
+        old = v->u.o.m;
+        reuse = MILO_OSIZE(v);
+        v->type = MILO_NULL;
+    }
     milo_parse_whitespace(c);
     if (*c->json == '}') {
         c->json++;
+        milo_free_members(old, 0, reuse);
+        free(old);
         v->type = MILO_OBJECT;
         v->u.o.m = 0;
-        v->u.o.size = 0;
+        MILO_OSIZE(v) = 0;
         return MILO_PARSE_OK;
     }
-    m.k = NULL;
     size = 0;
     for (;;) {
         char* str;
-        milo_init(&m.v);
+        if (used < reuse)
+            m = old[used++];
+        else {
+            m.k = NULL;
+            milo_init(&m.v);
+        }
         /* parse key */
         if (*c->json != '"') {
             ret = MILO_PARSE_MISS_KEY;
@@ -264,7 +730,7 @@ static int milo_parse_object(milo_context* c, milo_value* v) {
         }
         if ((ret = milo_parse_string_raw(c, &str, &m.klen)) != MILO_PARSE_OK)
             break;
-        memcpy(m.k = (char*)malloc(m.klen + 1), str, m.klen);
+        memcpy(m.k = (char*)realloc(m.k, m.klen + 1), str, m.klen);
         m.k[m.klen] = '\0';
         /* parse ws colon ws */
         milo_parse_whitespace(c);
@@ -280,18 +746,24 @@ static int milo_parse_object(milo_context* c, milo_value* v) {
         memcpy(milo_context_push(c, sizeof(milo_member)), &m, sizeof(milo_member));
         size++;
         m.k = NULL; /* ownership is transferred to member on stack */
+        milo_init(&m.v);
         /* parse ws [comma | right-curly-brace] ws */
         milo_parse_whitespace(c);
         if (*c->json == ',') {
             c->json++;
             milo_parse_whitespace(c);
         }
+        else if (*c->json == '}' && !MILO_SIZE_FITS(size)) {
+            ret = MILO_PARSE_SIZE_TOO_BIG;
+            break;
+        }
         else if (*c->json == '}') {
             size_t s = sizeof(milo_member) * size;
             c->json++;
+            milo_free_members(old, used, reuse);
             v->type = MILO_OBJECT;
-            v->u.o.size = size;
-            memcpy(v->u.o.m = (milo_member*)malloc(s), milo_context_pop(c, s), s);
+            MILO_OSIZE(v) = size;
+            memcpy(v->u.o.m = (milo_member*)realloc(old, s), milo_context_pop(c, s), s);
             return MILO_PARSE_OK;
         }
         else {
@@ -301,17 +773,33 @@ static int milo_parse_object(milo_context* c, milo_value* v) {
     }
     /* Pop and free members on the stack */
     free(m.k);
+    milo_free_value(&m.v);
     for (i = 0; i < size; i++) {
         milo_member* m = (milo_member*)milo_context_pop(c, sizeof(milo_member));
         free(m->k);
         milo_free(&m->v);
     }
+    milo_free_members(old, used, reuse);
+    free(old);
     v->type = MILO_NULL;
     return ret;
 }
 
+/*
+ * v is null, or with MILO_PARSE_OPT_RECYCLE an old value whose buffers are
+ * reused if it is a string, array or object again.  On error v is null.
+ */
 static int milo_parse_value(milo_context *c, milo_value *v) {
-    switch (*c->json) {
+    char ch = *c->json;
+    int ret;
+    if (v->type != MILO_NULL && !(ch == '"' && v->type == MILO_STRING) &&
+        !(ch == '[' && v->type == MILO_ARRAY) && !(ch == '{' && v->type == MILO_OBJECT))
+        milo_free_value(v);
+#ifdef MILO_STRINGIFY_CACHE
+    v->parent = NULL; /* a recycled value may carry stale cached text */
+    v->coff = v->clen = 0;
+#endif
+    switch (ch) {
         case 'f':
             return milo_parse_literal(c, v, "false", MILO_FALSE);
         case 't':
@@ -321,7 +809,9 @@ static int milo_parse_value(milo_context *c, milo_value *v) {
         case '\0':
             return MILO_PARSE_EXPECT_VALUE;
         case '"':
-            return milo_parse_string(c, v);
+            if ((ret = milo_parse_string(c, v)) != MILO_PARSE_OK)
+                milo_free_value(v);
+            return ret;
         case '[':  return milo_parse_array(c, v);
         case '{':  return milo_parse_object(c, v);
         default:
@@ -330,18 +820,24 @@ static int milo_parse_value(milo_context *c, milo_value *v) {
 }
 
 int milo_parse(milo_value *v, const char *json) {
+    return milo_parse_ex(v, json, 0);
+}
+
+int milo_parse_ex(milo_value* v, const char* json, unsigned flags) {
     milo_context c;
     int ret;
     assert(v != NULL);
     c.json = json;
     c.stack = NULL;
     c.size = c.top = 0;
-    milo_init(v);
+    c.flags = flags;
+    if (!(flags & MILO_PARSE_OPT_RECYCLE))
+        milo_init(v);
     milo_parse_whitespace(&c);
     if ((ret = milo_parse_value(&c, v)) == MILO_PARSE_OK) {
         milo_parse_whitespace(&c);
         if (*c.json != '\0') {
-            v->type = MILO_NULL;
+            milo_free(v);
             ret = MILO_PARSE_ROOT_NOT_SINGULAR;
         }
     }
@@ -350,211 +846,2236 @@ int milo_parse(milo_value *v, const char *json) {
     return ret;
 }
 
-#if 0
-// Unoptimized
-static void milo_stringify_string(milo_context* c, const char* s, size_t len) {
-    size_t i;
-    assert(s != NULL);
-    PUTC(c, '"');
-    for (i = 0; i < len; i++) {
-        unsigned char ch = (unsigned char)s[i];
-        switch (ch) {
-            case '\"': PUTS(c, "\\\"", 2); break;
-            case '\\': PUTS(c, "\\\\", 2); break;
-            case '\b': PUTS(c, "\\b",  2); break;
-            case '\f': PUTS(c, "\\f",  2); break;
-            case '\n': PUTS(c, "\\n",  2); break;
-            case '\r': PUTS(c, "\\r",  2); break;
-            case '\t': PUTS(c, "\\t",  2); break;
-            default:
-                if (ch < 0x20) {
-                    char buffer[7];
-                    sprintf(buffer, "\\u%04X", ch);
-                    PUTS(c, buffer, 6);
-                }
-                else
-                    PUTC(c, s[i]);
-        }
-    }
-    PUTC(c, '"');
+void milo_iter_init(milo_iter* it, const char* json, unsigned flags) {
+    assert(it != NULL && json != NULL);
+    it->json = json;
+    it->offset = 0;
+    it->flags = flags;
+    it->stack = NULL;
+    it->size = 0;
 }
-#else
-static void milo_stringify_string(milo_context* c, const char* s, size_t len) {
-    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-    size_t i, size;
-    char* head, *p;
-    assert(s != NULL);
-    p = head = milo_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
-    *p++ = '"';
-    for (i = 0; i < len; i++) {
-        unsigned char ch = (unsigned char)s[i];
-        switch (ch) {
-            case '\"': *p++ = '\\'; *p++ = '\"'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '\b': *p++ = '\\'; *p++ = 'b';  break;
-            case '\f': *p++ = '\\'; *p++ = 'f';  break;
-            case '\n': *p++ = '\\'; *p++ = 'n';  break;
-            case '\r': *p++ = '\\'; *p++ = 'r';  break;
-            case '\t': *p++ = '\\'; *p++ = 't';  break;
-            default:
-                if (ch < 0x20) {
-                    *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
-                    *p++ = hex_digits[ch >> 4];
-                    *p++ = hex_digits[ch & 15];
-                }
-                else
-                    *p++ = s[i];
-        }
+
+int milo_parse_next(milo_iter* it, milo_value* v) {
+    milo_context c;
+    const char* p;
+    int ret;
+    assert(it != NULL && v != NULL);
+    if (!(it->flags & MILO_PARSE_OPT_RECYCLE))
+        milo_init(v);
+    /* Documents may be separated by whitespace and RFC 7464 record separators */
+    for (p = it->json + it->offset; *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\x1E'; p++)
+        ;
+    if (*p == '\0') {
+        milo_free(v);
+        it->offset = p - it->json;
+        return MILO_PARSE_END;
     }
-    *p++ = '"';
-    c->top -= size - (p - head);
+    c.json = p;
+    c.stack = it->stack;
+    c.size = it->size;
+    c.top = 0;
+    c.flags = it->flags;
+    ret = milo_parse_value(&c, v);
+    it->offset = (ret == MILO_PARSE_OK ? c.json : p) - it->json;
+    assert(c.top == 0);
+    it->stack = c.stack;
+    it->size = c.size;
+    return ret;
 }
-#endif
 
-static void milo_stringify_value(milo_context* c, const milo_value* v) {
-    size_t i;
-    switch (v->type) {
-        case MILO_NULL:   PUTS(c, "null",  4); break;
-        case MILO_FALSE:  PUTS(c, "false", 5); break;
-        case MILO_TRUE:   PUTS(c, "true",  4); break;
-        case MILO_NUMBER: c->top -= 32 - sprintf(milo_context_push(c, 32), "%.17g", v->u.n); break;
-        case MILO_STRING: milo_stringify_string(c, v->u.s.s, v->u.s.len); break;
-        case MILO_ARRAY:
-            PUTC(c, '[');
-            for (i = 0; i < v->u.a.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                milo_stringify_value(c, &v->u.a.e[i]);
-            }
-            PUTC(c, ']');
-            break;
-        case MILO_OBJECT:
-            PUTC(c, '{');
-            for (i = 0; i < v->u.o.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                milo_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
-                PUTC(c, ':');
-                milo_stringify_value(c, &v->u.o.m[i].v);
-            }
-            PUTC(c, '}');
-            break;
-        default: assert(0 && "invalid type");
-    }
+void milo_iter_free(milo_iter* it) {
+    assert(it != NULL);
+    free(it->stack);
+    it->stack = NULL;
+    it->size = 0;
 }
 
-char* milo_stringify(const milo_value* v, size_t* length) {
-    milo_context c;
-    assert(v != NULL);
-    c.stack = (char*)malloc(c.size = MILO_PARSE_STRINGIFY_INIT_SIZE);
-    c.top = 0;
-    milo_stringify_value(&c, v);
-    if (length)
-        *length = c.top;
-    PUTC(&c, '\0');
-    return c.stack;
+/*
+ * Validation: the full grammar is checked without decoding or allocating.
+ * Input is either bounded by end or, with end == NULL, null-terminated;
+ * MILO_PEEK reads the byte at end as a terminator so both share one scanner.
+ */
+#ifndef MILO_FORMAT_BUFFER_SIZE
+#define MILO_FORMAT_BUFFER_SIZE 4096
+#endif
+
+/* Output of minify/prettify, batched into a fixed buffer */
+typedef struct {
+    milo_writer write;
+    void* context;
+    unsigned indent;
+    int pretty;
+    size_t depth, used;
+    char buffer[MILO_FORMAT_BUFFER_SIZE];
+} milo_formatter;
+
+typedef struct {
+    const char* p, *end;
+    int utf8; /* reject ill-formed UTF-8 */
+    milo_formatter* out; /* receives every token as it is validated, or NULL */
+} milo_validator;
+
+#define MILO_PEEK(s, q) ((q) != (s)->end ? *(q) : '\0')
+
+static void milo_format_flush(milo_formatter* f) {
+    if (f->used > 0)
+        f->write(f->context, f->buffer, f->used);
+    f->used = 0;
 }
 
-void milo_free(milo_value* v) {
-    size_t  i;
-    assert( v!= NULL);
-    switch (v->type) {
-        case MILO_STRING:
-            free(v->u.s.s);
-            break;
-        case MILO_ARRAY:
-            for (i = 0; i < v->u.a.size; i++)
-                milo_free(&v->u.a.e[i]);
-            free(v->u.a.e);
-            break;
-        case MILO_OBJECT:
-            for (i = 0; i < v->u.o.size; i++) {
-                free(v->u.o.m[i].k);
-                milo_free(&v->u.o.m[i].v);
-            }
-            free(v->u.o.m);
-            break;
-        default: break;
+/* Tokens are copied verbatim; long ones go to the writer directly */
+static void milo_format_write(milo_formatter* f, const char* s, size_t len) {
+    if (f->used + len > MILO_FORMAT_BUFFER_SIZE) {
+        milo_format_flush(f);
+        if (len > MILO_FORMAT_BUFFER_SIZE / 2) {
+            f->write(f->context, s, len);
+            return;
+        }
     }
-    v->type = MILO_NULL;
+    memcpy(f->buffer + f->used, s, len);
+    f->used += len;
 }
 
-milo_type milo_get_type(const milo_value *v) {
-    assert(v != NULL);
-    return v->type;
+static void milo_format_token(milo_validator* s, const char* start) {
+    if (s->out != NULL)
+        milo_format_write(s->out, start, s->p - start);
 }
 
-int milo_get_boolean(const milo_value* v) {
-    assert(v != NULL && (v->type == MILO_TRUE || v->type == MILO_FALSE));
-    return v->type == MILO_TRUE;
+static void milo_format_char(milo_validator* s, char ch) {
+    if (s->out != NULL)
+        milo_format_write(s->out, &ch, 1);
 }
 
-void milo_set_boolean(milo_value* v, int b) {
-    milo_free(v);
-    v->type = b ? MILO_TRUE : MILO_FALSE;
+/* Prettify only: a line break indented to the current depth */
+static void milo_format_break(milo_validator* s) {
+    static const char spaces[] = "                                ";
+    size_t n;
+    if (s->out == NULL || !s->out->pretty)
+        return;
+    milo_format_write(s->out, "\n", 1);
+    for (n = s->out->depth * s->out->indent; n > 0; ) {
+        size_t k = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        milo_format_write(s->out, spaces, k);
+        n -= k;
+    }
 }
 
-double milo_get_number(const milo_value* v) {
-    assert(v != NULL && v->type == MILO_NUMBER);
-    return v->u.n;
+/* Opens or closes a container: '[' or '{' go deeper, ']' or '}' come back */
+static void milo_format_nest(milo_validator* s, char ch, int empty) {
+    if (s->out == NULL)
+        return;
+    if (ch == ']' || ch == '}') {
+        s->out->depth--;
+        if (!empty)
+            milo_format_break(s);
+    }
+    else
+        s->out->depth++;
+    milo_format_write(s->out, &ch, 1);
 }
 
-void milo_set_number(milo_value*v, double n) {
-    milo_free(v);
-    v->u.n = n;
-    v->type = MILO_NUMBER;
-}
+/* 2^1024 - 2^970: the smallest decimal that strtod() rounds up to infinity */
+static const char milo_overflow_digits[] =
+    "17976931348623158079372897140530341507993413271003782693617377898044496829276475094664901797758720709"
+    "63302864166928879109465555478519404026306574886715058206819089020007083836762738548458177115317644757"
+    "30270069855571366959622842914819860834936475292719074168444365510704342711559699508093042880177904174"
+    "497792";
 
-const char* milo_get_string(const milo_value* v) {
-    assert(v != NULL && v->type == MILO_STRING);
-    return v->u.s.s;
-}
+#define MILO_IS_WHITESPACE(ch) ((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+
+static void milo_validate_whitespace(milo_validator* s) {
+    const char* p = s->p;
+    char ch;
+#ifdef MILO_SSE2
+    /* Indentation runs are skipped 16 bytes at a time */
+    if (s->end != NULL && s->end - p >= 16 && MILO_IS_WHITESPACE(*p)) {
+        const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+        const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+        for (; s->end - p >= 16; p += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i*)p);
+            __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab)),
+                _mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)));
+            unsigned mask = ~(unsigned)_mm_movemask_epi8(m) & 0xFFFF;
+            if (mask != 0) {
+                s->p = p + milo_ctz(mask);
+                return;
+            }
+        }
+    }
+#endif
+    while ((ch = MILO_PEEK(s, p)) != '\0' && MILO_IS_WHITESPACE(ch))
+        p++;
+    s->p = p;
+}
+
+static int milo_validate_literal(milo_validator* s, const char* literal) {
+    size_t i;
+    for (i = 0; literal[i]; i++)
+        if (MILO_PEEK(s, s->p + i) != literal[i])
+            return MILO_PARSE_INVALID_VALUE;
+    s->p += i;
+    return MILO_PARSE_OK;
+}
+
+#define MILO_SATURATE 1000000L /* beyond any exponent that matters */
+
+/*
+ * Same grammar and range check as the parser, but without strtod(), which
+ * could read past end: the magnitude follows from the digit count and
+ * exponent, and only numbers near DBL_MAX compare their digits.
+ */
+static int milo_validate_number(milo_validator* s) {
+    const char* p = s->p, *sig = NULL;
+    long e = 0, exp = 0, zeros = 0;
+    int neg = 0;
+    if (MILO_PEEK(s, p) == '-')
+        p++;
+    if (MILO_PEEK(s, p) == '0')
+        p++;
+    else if (ISDIGIT1TO9(MILO_PEEK(s, p))) {
+        for (sig = p; ISDIGHT(MILO_PEEK(s, p)); p++)
+            if (e < MILO_SATURATE)
+                e++;
+    }
+    else
+        return MILO_PARSE_INVALID_VALUE;
+    if (MILO_PEEK(s, p) == '.') {
+        p++;
+        if (!ISDIGHT(MILO_PEEK(s, p)))
+            return MILO_PARSE_INVALID_VALUE;
+        for (; ISDIGHT(MILO_PEEK(s, p)); p++)
+            if (sig == NULL) {
+                if (*p != '0')
+                    sig = p;
+                else if (zeros < MILO_SATURATE)
+                    zeros++;
+            }
+        if (e == 0)
+            e = -zeros;
+    }
+    if (MILO_PEEK(s, p) == 'e' || MILO_PEEK(s, p) == 'E') {
+        p++;
+        if (MILO_PEEK(s, p) == '+' || MILO_PEEK(s, p) == '-')
+            neg = *p++ == '-';
+        if (!ISDIGHT(MILO_PEEK(s, p)))
+            return MILO_PARSE_INVALID_VALUE;
+        for (; ISDIGHT(MILO_PEEK(s, p)); p++)
+            if (exp < MILO_SATURATE)
+                exp = exp * 10 + (*p - '0');
+    }
+    e += neg ? -exp : exp; /* the value lies in [10^(e-1), 10^e) */
+    if (sig != NULL && e >= 309) {
+        const char* d = sig, *t = milo_overflow_digits;
+        int cmp = e > 309;
+        while (!cmp) {
+            if (d != p && *d == '.')
+                d++;
+            if (d == p || !ISDIGHT(*d)) {
+                /* out of digits: equal only if the threshold has no more nonzero digits */
+                for (; *t == '0'; t++)
+                    ;
+                cmp = *t == '\0';
+                break;
+            }
+            if (*t == '\0' || *d != *t) {
+                cmp = *t == '\0' || *d > *t;
+                break;
+            }
+            d++;
+            t++;
+        }
+        if (cmp)
+            return MILO_PARSE_NUMBER_TOO_BIG;
+    }
+    s->p = p;
+    return MILO_PARSE_OK;
+}
+
+static int milo_validate_string(milo_validator* s) {
+    const char* p = s->p + 1, *q;
+    unsigned u;
+    for (;;) {
+        p = s->end != NULL ? milo_scan_string_n(p, s->end, s->utf8) : milo_scan_string(p, s->utf8);
+        switch (MILO_PEEK(s, p)) {
+            case '\"':
+                s->p = p + 1;
+                return MILO_PARSE_OK;
+            case '\\':
+                s->p = p++;
+                switch (MILO_PEEK(s, p)) {
+                    case '\"': case '\\': case '/': case 'b':
+                    case 'f':  case 'n':  case 'r': case 't':
+                        p++;
+                        break;
+                    case 'u':
+                        if ((s->end != NULL && s->end - p < 5) || !(p = milo_parse_hex4(p + 1, &u)))
+                            return MILO_PARSE_INVALID_UNICODE_HEX;
+                        if (u >= 0xD800 && u <= 0xDBFF) {
+                            if (MILO_PEEK(s, p) != '\\' || MILO_PEEK(s, p + 1) != 'u')
+                                return MILO_PARSE_INVALID_UNICODE_SURROGATE;
+                            if ((s->end != NULL && s->end - p < 6) || !(p = milo_parse_hex4(p + 2, &u)))
+                                return MILO_PARSE_INVALID_UNICODE_HEX;
+                            if (u < 0xDC00 || u > 0xDFFF)
+                                return MILO_PARSE_INVALID_UNICODE_SURROGATE;
+                        }
+                        break;
+                    default:
+                        return MILO_PARSE_INVALID_STRING_ESCAPE;
+                }
+                break;
+            case '\0':
+                s->p = p;
+                return MILO_PARSE_MISS_QUOTATION_MARK;
+            default:
+                s->p = p;
+                if ((unsigned char)*p < 0x20)
+                    return MILO_PARSE_INVALID_STRING_CHAR;
+                if ((q = milo_skip_utf8(p, s->end)) != p) {
+                    p = q;
+                    break;
+                }
+                if (s->end != NULL && s->end - p < 4) {
+                    /* a sequence cut off by end fails on the zero padding */
+                    char tail[4] = { 0, 0, 0, 0 };
+                    memcpy(tail, p, s->end - p);
+                    q = milo_validate_utf8(tail);
+                    q = q != NULL ? p + (q - tail) : NULL;
+                }
+                else
+                    q = milo_validate_utf8(p);
+                if ((p = q) == NULL)
+                    return MILO_PARSE_INVALID_UTF8;
+        }
+    }
+}
+
+static int milo_validate_value(milo_validator* s); /* forward declaration */
+
+static int milo_validate_array(milo_validator* s) {
+    int ret;
+    s->p++;
+    milo_format_nest(s, '[', 0);
+    milo_validate_whitespace(s);
+    if (MILO_PEEK(s, s->p) == ']') {
+        s->p++;
+        milo_format_nest(s, ']', 1);
+        return MILO_PARSE_OK;
+    }
+    for (;;) {
+        milo_format_break(s);
+        if ((ret = milo_validate_value(s)) != MILO_PARSE_OK)
+            return ret;
+        milo_validate_whitespace(s);
+        switch (MILO_PEEK(s, s->p)) {
+            case ',':
+                s->p++;
+                milo_format_char(s, ',');
+                milo_validate_whitespace(s);
+                break;
+            case ']':
+                s->p++;
+                milo_format_nest(s, ']', 0);
+                return MILO_PARSE_OK;
+            default:
+                return MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+        }
+    }
+}
+
+static int milo_validate_object(milo_validator* s) {
+    const char* key;
+    int ret;
+    s->p++;
+    milo_format_nest(s, '{', 0);
+    milo_validate_whitespace(s);
+    if (MILO_PEEK(s, s->p) == '}') {
+        s->p++;
+        milo_format_nest(s, '}', 1);
+        return MILO_PARSE_OK;
+    }
+    for (;;) {
+        milo_format_break(s);
+        if (MILO_PEEK(s, key = s->p) != '"')
+            return MILO_PARSE_MISS_KEY;
+        if ((ret = milo_validate_string(s)) != MILO_PARSE_OK)
+            return ret;
+        milo_format_token(s, key);
+        milo_validate_whitespace(s);
+        if (MILO_PEEK(s, s->p) != ':')
+            return MILO_PARSE_MISS_COLON;
+        s->p++;
+        milo_format_char(s, ':');
+        if (s->out != NULL && s->out->pretty)
+            milo_format_char(s, ' ');
+        milo_validate_whitespace(s);
+        if ((ret = milo_validate_value(s)) != MILO_PARSE_OK)
+            return ret;
+        milo_validate_whitespace(s);
+        switch (MILO_PEEK(s, s->p)) {
+            case ',':
+                s->p++;
+                milo_format_char(s, ',');
+                milo_validate_whitespace(s);
+                break;
+            case '}':
+                s->p++;
+                milo_format_nest(s, '}', 0);
+                return MILO_PARSE_OK;
+            default:
+                return MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        }
+    }
+}
+
+static int milo_validate_value(milo_validator* s) {
+    const char* start = s->p;
+    int ret;
+    switch (MILO_PEEK(s, s->p)) {
+        case 'f':  ret = milo_validate_literal(s, "false"); break;
+        case 't':  ret = milo_validate_literal(s, "true"); break;
+        case 'n':  ret = milo_validate_literal(s, "null"); break;
+        case '\0': return MILO_PARSE_EXPECT_VALUE;
+        case '"':  ret = milo_validate_string(s); break;
+        case '[':  return milo_validate_array(s);
+        case '{':  return milo_validate_object(s);
+        default:   ret = milo_validate_number(s); break;
+    }
+    if (ret == MILO_PARSE_OK)
+        milo_format_token(s, start);
+    return ret;
+}
+
+static int milo_validate_text(const char* json, size_t len, size_t* err_offset, milo_formatter* out) {
+    milo_validator s;
+    int ret;
+    assert(json != NULL || len == 0);
+    s.p = json;
+    s.end = json + len;
+    s.utf8 = 1;
+    s.out = out;
+    milo_validate_whitespace(&s);
+    if ((ret = milo_validate_value(&s)) == MILO_PARSE_OK) {
+        milo_validate_whitespace(&s);
+        if (s.p != s.end)
+            ret = MILO_PARSE_ROOT_NOT_SINGULAR;
+    }
+    if (err_offset != NULL)
+        *err_offset = ret == MILO_PARSE_OK ? len : (size_t)(s.p - json);
+    return ret;
+}
+
+int milo_validate(const char* json, size_t len, size_t* err_offset) {
+    return milo_validate_text(json, len, err_offset, NULL);
+}
+
+static int milo_format(const char* json, size_t len, unsigned indent, int pretty,
+    milo_writer write, void* context, size_t* err_offset) {
+    milo_formatter f;
+    int ret;
+    assert(write != NULL);
+    f.write = write;
+    f.context = context;
+    f.indent = indent;
+    f.pretty = pretty;
+    f.depth = f.used = 0;
+    ret = milo_validate_text(json, len, err_offset, &f);
+    milo_format_flush(&f);
+    return ret;
+}
+
+int milo_minify(const char* json, size_t len, milo_writer write, void* context, size_t* err_offset) {
+    return milo_format(json, len, 0, 0, write, context, err_offset);
+}
+
+int milo_prettify(const char* json, size_t len, unsigned indent, milo_writer write, void* context, size_t* err_offset) {
+    return milo_format(json, len, indent, 1, write, context, err_offset);
+}
+
+/*
+ * Projection: the requested paths are compiled into a trie of JSON Pointer
+ * segments, where "*" matches any member or element.  Values outside the
+ * projection are still validated but skipped without being decoded.
+ */
+typedef struct milo_projection milo_projection;
+struct milo_projection {
+    const char* seg;                /* path segment, still ~-escaped */
+    size_t len;
+    int keep;                       /* some path ends here: keep the whole value */
+    milo_projection* child, *next;  /* first child, next sibling */
+};
+
+/* Sets of projection nodes live on the context stack and are addressed by offset, as the stack may move */
+#define MILO_PROJECTION_SET(c, off) ((milo_projection**)((c)->stack + (off)))
+
+static milo_projection* milo_projection_add(milo_projection* parent, const char* seg, size_t len) {
+    milo_projection* p;
+    for (p = parent->child; p != NULL; p = p->next)
+        if (p->len == len && memcmp(p->seg, seg, len) == 0)
+            return p;
+    p = (milo_projection*)malloc(sizeof(milo_projection));
+    p->seg = seg;
+    p->len = len;
+    p->keep = 0;
+    p->child = NULL;
+    p->next = parent->child;
+    parent->child = p;
+    return p;
+}
+
+static void milo_projection_free(milo_projection* p) {
+    while (p != NULL) {
+        milo_projection* next = p->next;
+        milo_projection_free(p->child);
+        free(p);
+        p = next;
+    }
+}
+
+static int milo_projection_match_key(const milo_projection* p, const char* k, size_t klen) {
+    size_t i, j;
+    if (p->len == 1 && p->seg[0] == '*')
+        return 1;
+    for (i = j = 0; i < p->len; i++, j++) {
+        char ch = p->seg[i];
+        if (ch == '~' && i + 1 < p->len && (p->seg[i + 1] == '0' || p->seg[i + 1] == '1'))
+            ch = p->seg[++i] == '0' ? '~' : '/';
+        if (j == klen || k[j] != ch)
+            return 0;
+    }
+    return j == klen;
+}
+
+static int milo_projection_match_index(const milo_projection* p, size_t index) {
+    size_t i, n = 0;
+    if (p->len == 1 && p->seg[0] == '*')
+        return 1;
+    if (p->len == 0 || (p->len > 1 && p->seg[0] == '0'))
+        return 0;
+    for (i = 0; i < p->len; i++) {
+        if (!ISDIGHT(p->seg[i]))
+            return 0;
+        n = n * 10 + (p->seg[i] - '0');
+    }
+    return n == index;
+}
+
+/* The children of set that match a member key (k != NULL) or an element index. */
+static size_t milo_projection_step(milo_projection** set, size_t n, milo_projection** next,
+    const char* k, size_t klen, size_t index, int* keep) {
+    size_t i, count = 0;
+    milo_projection* p;
+    *keep = 0;
+    for (i = 0; i < n; i++)
+        for (p = set[i]->child; p != NULL; p = p->next)
+            if (k != NULL ? milo_projection_match_key(p, k, klen) : milo_projection_match_index(p, index)) {
+                *keep |= p->keep;
+                next[count++] = p;
+            }
+    return count;
+}
+
+static size_t milo_projection_fanout(milo_projection** set, size_t n) {
+    size_t i, count = 0;
+    milo_projection* p;
+    for (i = 0; i < n; i++)
+        for (p = set[i]->child; p != NULL; p = p->next)
+            count++;
+    return count;
+}
+
+/* Skipped values are validated without decoding */
+static int milo_skip_value(milo_context* c) {
+    milo_validator s;
+    int ret;
+    s.p = c->json;
+    s.end = NULL;
+    s.utf8 = (c->flags & MILO_PARSE_OPT_VALIDATE_UTF8) != 0;
+    s.out = NULL;
+    ret = milo_validate_value(&s);
+    c->json = s.p;
+    return ret;
+}
+
+static int milo_parse_projected_value(milo_context* c, milo_value* v, size_t set, size_t n, int* kept);
+
+/* Decodes an already validated key with escapes; *str is valid until the next push */
+static void milo_decode_key(milo_context* c, const char* k, char** str, size_t* klen) {
+    const char* json = c->json;
+    c->json = k - 1;
+    milo_parse_string_raw(c, str, klen);
+    c->json = json;
+}
+
+/*
+ * Parses, skips or descends into one member or element depending on the
+ * projection.  k is the raw key in the input, or NULL for an element.
+ */
+static int milo_parse_projected_child(milo_context* c, milo_value* v, size_t set, size_t n,
+    const char* k, size_t klen, size_t index, int* kept) {
+    size_t top = c->top, next, count = milo_projection_fanout(MILO_PROJECTION_SET(c, set), n);
+    char* key = (char*)k;
+    int keep, ret;
+    if (c->top % sizeof(milo_projection*) != 0)
+        milo_context_push(c, sizeof(milo_projection*) - c->top % sizeof(milo_projection*));
+    next = c->top;
+    if (count > 0)
+        milo_context_push(c, count * sizeof(milo_projection*));
+    if (k != NULL && memchr(k, '\\', klen) != NULL)
+        milo_decode_key(c, k, &key, &klen);
+    count = milo_projection_step(MILO_PROJECTION_SET(c, set), n, MILO_PROJECTION_SET(c, next),
+        key, klen, index, &keep);
+    if (keep) {
+        *kept = 1;
+        ret = milo_parse_value(c, v);
+    }
+    else if (count == 0) {
+        *kept = 0;
+        ret = milo_skip_value(c);
+    }
+    else
+        ret = milo_parse_projected_value(c, v, next, count, kept);
+    milo_context_pop(c, c->top - top);
+    return ret;
+}
+
+static int milo_parse_projected_array(milo_context* c, milo_value* v, size_t set, size_t n) {
+    size_t i, index, size = 0;
+    int ret, kept;
+    EXPECT(c, '[');
+    milo_parse_whitespace(c);
+    for (index = 0; *c->json != ']'; index++) {
+        milo_value e;
+        if (index > 0) {
+            if (*c->json != ',') {
+                ret = MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+                goto error;
+            }
+            c->json++;
+            milo_parse_whitespace(c);
+        }
+        milo_init(&e);
+        if ((ret = milo_parse_projected_child(c, &e, set, n, NULL, 0, index, &kept)) != MILO_PARSE_OK)
+            goto error;
+        if (kept) {
+            memcpy(milo_context_push(c, sizeof(milo_value)), &e, sizeof(milo_value));
+            size++;
+        }
+        milo_parse_whitespace(c);
+    }
+    if (!MILO_SIZE_FITS(size)) {
+        ret = MILO_PARSE_SIZE_TOO_BIG;
+        goto error;
+    }
+    c->json++;
+    v->type = MILO_ARRAY;
+    v->flags = 0;
+    MILO_ASIZE(v) = size;
+    v->u.a.e = NULL;
+    if (size > 0) {
+        size *= sizeof(milo_value);
+        memcpy(v->u.a.e = (milo_value*)malloc(size), milo_context_pop(c, size), size);
+    }
+    return MILO_PARSE_OK;
+error:
+    for (i = 0; i < size; i++)
+        milo_free((milo_value*)milo_context_pop(c, sizeof(milo_value)));
+    return ret;
+}
+
+static int milo_parse_projected_object(milo_context* c, milo_value* v, size_t set, size_t n) {
+    size_t i, count, size = 0;
+    milo_member m;
+    int ret, kept;
+    EXPECT(c, '{');
+    milo_parse_whitespace(c);
+    for (count = 0; *c->json != '}'; count++) {
+        milo_validator s;
+        const char* k;
+        milo_init(&m.v);
+        if (count > 0) {
+            if (*c->json != ',') {
+                ret = MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+                goto error;
+            }
+            c->json++;
+            milo_parse_whitespace(c);
+        }
+        if (*c->json != '"') {
+            ret = MILO_PARSE_MISS_KEY;
+            goto error;
+        }
+        /* Keys are matched in place and only copied for kept members */
+        s.p = c->json;
+        s.end = NULL;
+        s.utf8 = (c->flags & MILO_PARSE_OPT_VALIDATE_UTF8) != 0;
+        s.out = NULL;
+        if ((ret = milo_validate_string(&s)) != MILO_PARSE_OK)
+            goto error;
+        k = c->json + 1;
+        m.klen = (size_t)(s.p - k - 1);
+        c->json = s.p;
+        milo_parse_whitespace(c);
+        if (*c->json != ':') {
+            ret = MILO_PARSE_MISS_COLON;
+            goto error;
+        }
+        c->json++;
+        milo_parse_whitespace(c);
+        if ((ret = milo_parse_projected_child(c, &m.v, set, n, k, m.klen, 0, &kept)) != MILO_PARSE_OK)
+            goto error;
+        if (kept) {
+            char* str = (char*)k;
+            if (memchr(k, '\\', m.klen) != NULL)
+                milo_decode_key(c, k, &str, &m.klen);
+            memcpy(m.k = (char*)malloc(m.klen + 1), str, m.klen);
+            m.k[m.klen] = '\0';
+            memcpy(milo_context_push(c, sizeof(milo_member)), &m, sizeof(milo_member));
+            size++;
+        }
+        milo_parse_whitespace(c);
+    }
+    if (!MILO_SIZE_FITS(size)) {
+        ret = MILO_PARSE_SIZE_TOO_BIG;
+        goto error;
+    }
+    c->json++;
+    v->type = MILO_OBJECT;
+    MILO_OSIZE(v) = size;
+    v->u.o.m = NULL;
+    if (size > 0) {
+        size *= sizeof(milo_member);
+        memcpy(v->u.o.m = (milo_member*)malloc(size), milo_context_pop(c, size), size);
+    }
+    return MILO_PARSE_OK;
+error:
+    for (i = 0; i < size; i++) {
+        milo_member* pm = (milo_member*)milo_context_pop(c, sizeof(milo_member));
+        free(pm->k);
+        milo_free(&pm->v);
+    }
+    return ret;
+}
+
+/* Only containers can hold the rest of a path; anything else is skipped. */
+static int milo_parse_projected_value(milo_context* c, milo_value* v, size_t set, size_t n, int* kept) {
+    switch (*c->json) {
+        case '[':
+            *kept = 1;
+            return milo_parse_projected_array(c, v, set, n);
+        case '{':
+            *kept = 1;
+            return milo_parse_projected_object(c, v, set, n);
+        default:
+            *kept = 0;
+            return milo_skip_value(c);
+    }
+}
+
+int milo_parse_projected(milo_value* v, const char* json, const char* const* paths, size_t count, unsigned flags) {
+    milo_context c;
+    milo_projection root;
+    size_t i;
+    int ret, kept;
+    assert(v != NULL && (paths != NULL || count == 0));
+    root.seg = NULL;
+    root.len = 0;
+    root.keep = 0;
+    root.child = NULL;
+    for (i = 0; i < count; i++) {
+        const char* p = paths[i];
+        milo_projection* node = &root;
+        assert(*p == '/' || *p == '\0');
+        while (*p == '/') {
+            const char* seg = ++p;
+            while (*p != '/' && *p != '\0')
+                p++;
+            node = milo_projection_add(node, seg, (size_t)(p - seg));
+        }
+        node->keep = 1;
+    }
+    c.json = json;
+    c.stack = NULL;
+    c.size = c.top = 0;
+    c.flags = flags;
+    milo_init(v);
+    milo_parse_whitespace(&c);
+    milo_context_push(&c, sizeof(milo_projection*)); /* the root set, at offset 0 */
+    *MILO_PROJECTION_SET(&c, 0) = &root;
+    if (root.keep)
+        ret = milo_parse_value(&c, v);
+    else if ((ret = milo_parse_projected_value(&c, v, 0, 1, &kept)) == MILO_PARSE_OK && !kept)
+        v->type = MILO_NULL;
+    milo_context_pop(&c, sizeof(milo_projection*));
+    if (ret == MILO_PARSE_OK) {
+        milo_parse_whitespace(&c);
+        if (*c.json != '\0') {
+            milo_free(v);
+            ret = MILO_PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    else
+        v->type = MILO_NULL;
+    assert(c.top == 0);
+    free(c.stack);
+    milo_projection_free(root.child);
+    return ret;
+}
+
+#if 0
+// Unoptimized
+static void milo_stringify_string(milo_context* c, const char* s, size_t len) {
+    size_t i;
+    assert(s != NULL);
+    PUTC(c, '"');
+    for (i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        switch (ch) {
+            case '\"': PUTS(c, "\\\"", 2); break;
+            case '\\': PUTS(c, "\\\\", 2); break;
+            case '\b': PUTS(c, "\\b",  2); break;
+            case '\f': PUTS(c, "\\f",  2); break;
+            case '\n': PUTS(c, "\\n",  2); break;
+            case '\r': PUTS(c, "\\r",  2); break;
+            case '\t': PUTS(c, "\\t",  2); break;
+            default:
+                if (ch < 0x20) {
+                    char buffer[7];
+                    sprintf(buffer, "\\u%04X", ch);
+                    PUTS(c, buffer, 6);
+                }
+                else
+                    PUTC(c, s[i]);
+        }
+    }
+    PUTC(c, '"');
+}
+#else
+#ifdef MILO_POSIX
+/* Ends the open scratch run; its base is filled in once the scratch buffer stops moving. */
+static void milo_iov_close(milo_context* c) {
+    if (c->top > c->seg) {
+        c->iov[c->iovcnt].iov_base = NULL;
+        c->iov[c->iovcnt++].iov_len = c->top - c->seg;
+        c->seg = c->top;
+    }
+}
+
+/* References s in place while there is room for it and a final scratch run, copies it otherwise. */
+static void milo_iov_ref(milo_context* c, const char* s, size_t len) {
+    if (c->iovcnt + (c->top > c->seg) + 2 <= c->iovmax) {
+        milo_iov_close(c);
+        c->iov[c->iovcnt].iov_base = (void*)s;
+        c->iov[c->iovcnt++].iov_len = len;
+    }
+    else
+        WRITES(c, s, len);
+}
+#endif
+
+/* Clean runs are copied in bulk; the output only grows by what is actually written */
+static void milo_stringify_string(milo_context* c, const char* s, size_t len) {
+    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+    const char* end = s + len, *q;
+    char buffer[6];
+    assert(s != NULL);
+    WRITEC(c, '"');
+    for (;;) {
+        if ((q = milo_scan_string_n(s, end, 0)) != s) {
+#ifdef MILO_POSIX
+            if (c->output == MILO_OUTPUT_IOV && (size_t)(q - s) >= MILO_STRINGIFY_IOV_MIN_REF)
+                milo_iov_ref(c, s, q - s);
+            else
+#endif
+            WRITES(c, s, q - s);
+            s = q;
+        }
+        if (s == end)
+            break;
+        switch (*s) {
+            case '\"': WRITES(c, "\\\"", 2); break;
+            case '\\': WRITES(c, "\\\\", 2); break;
+            case '\b': WRITES(c, "\\b",  2); break;
+            case '\f': WRITES(c, "\\f",  2); break;
+            case '\n': WRITES(c, "\\n",  2); break;
+            case '\r': WRITES(c, "\\r",  2); break;
+            case '\t': WRITES(c, "\\t",  2); break;
+            default:
+                buffer[0] = '\\'; buffer[1] = 'u'; buffer[2] = '0'; buffer[3] = '0';
+                buffer[4] = hex_digits[(unsigned char)*s >> 4];
+                buffer[5] = hex_digits[(unsigned char)*s & 15];
+                WRITES(c, buffer, 6);
+        }
+        s++;
+    }
+    WRITEC(c, '"');
+}
+#endif
+
+/*
+ * Formats n as sprintf("%.17g") does.  Nonzero integers below 10^15 are
+ * exact in a double and written digit by digit, saving the libc call.
+ */
+static size_t milo_format_number(char* buffer, double n) {
+    char digits[16];
+    double m = n < 0.0 ? -n : n;
+    size_t len = 0, k = 0;
+    if (n == 0.0 || m >= 1e15 || m != floor(m))
+        return (size_t)sprintf(buffer, "%.17g", n);
+    do {
+        double q = floor(m / 10.0);
+        digits[k++] = (char)('0' + (int)(m - q * 10.0));
+        m = q;
+    } while (m > 0.0);
+    if (n < 0.0)
+        buffer[len++] = '-';
+    while (k > 0)
+        buffer[len++] = digits[--k];
+    return len;
+}
+
+/* One write per element: the separator goes in front of every number but the first */
+static void milo_stringify_packed(milo_context* c, const double* n, size_t size) {
+    char buffer[33];
+    size_t i;
+    buffer[0] = ',';
+    WRITEC(c, '[');
+    for (i = 0; i < size; i++)
+        WRITES(c, buffer + (i == 0), milo_format_number(buffer + 1, n[i]) + (i > 0));
+    WRITEC(c, ']');
+}
+
+static void milo_stringify_value(milo_context* c, const milo_value* v) {
+    char buffer[32];
+    size_t i;
+    switch (v->type) {
+        case MILO_NULL:   WRITES(c, "null",  4); break;
+        case MILO_FALSE:  WRITES(c, "false", 5); break;
+        case MILO_TRUE:   WRITES(c, "true",  4); break;
+        case MILO_NUMBER:
+            if (v->flags & MILO_NUMBER_LAZY) {
+                size_t len;
+                const char* lexeme = milo_get_number_lexeme(v, &len);
+                WRITES(c, lexeme, len);
+            }
+            else
+                WRITES(c, buffer, milo_format_number(buffer, v->u.n));
+            break;
+        case MILO_STRING: milo_stringify_string(c, v->u.s.s, MILO_SLEN(v)); break;
+        case MILO_ARRAY:
+            if (v->flags & MILO_ARRAY_PACKED) {
+                milo_stringify_packed(c, v->u.d.n, MILO_ASIZE(v));
+                break;
+            }
+            WRITEC(c, '[');
+            for (i = 0; i < MILO_ASIZE(v); i++) {
+                if (i > 0)
+                    WRITEC(c, ',');
+                milo_stringify_value(c, &v->u.a.e[i]);
+            }
+            WRITEC(c, ']');
+            break;
+        case MILO_OBJECT:
+            WRITEC(c, '{');
+            for (i = 0; i < MILO_OSIZE(v); i++) {
+                if (i > 0)
+                    WRITEC(c, ',');
+                milo_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
+                WRITEC(c, ':');
+                milo_stringify_value(c, &v->u.o.m[i].v);
+            }
+            WRITEC(c, '}');
+            break;
+        default: assert(0 && "invalid type");
+    }
+}
+
+char* milo_stringify(const milo_value* v, size_t* length) {
+    milo_context c;
+    assert(v != NULL);
+    c.stack = (char*)malloc(c.size = MILO_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    c.output = MILO_OUTPUT_DYNAMIC;
+    milo_stringify_value(&c, v);
+    if (length)
+        *length = c.top;
+    PUTC(&c, '\0');
+    return c.stack;
+}
+
+#ifdef MILO_STRINGIFY_CACHE
+/*
+ * Values whose text is still cached are copied from the previous output; the
+ * rest are formatted again.  Offsets are kept relative to the enclosing value
+ * so that a spliced subtree keeps valid offsets for all of its descendants.
+ */
+static void milo_stringify_cached_value(milo_context* c, milo_value* v, milo_value* parent,
+    const char* prev, size_t prev_parent, size_t parent_start) {
+    size_t i, start = c->top, prev_start = prev_parent + v->coff;
+    v->parent = parent;
+    if (prev != NULL && v->clen != 0)
+        WRITES(c, prev + prev_start, v->clen);
+    else {
+        switch (v->type) {
+            case MILO_ARRAY:
+                if (v->flags & MILO_ARRAY_PACKED) {
+                    milo_stringify_value(c, v);
+                    break;
+                }
+                WRITEC(c, '[');
+                for (i = 0; i < MILO_ASIZE(v); i++) {
+                    if (i > 0)
+                        WRITEC(c, ',');
+                    milo_stringify_cached_value(c, &v->u.a.e[i], v, prev, prev_start, start);
+                }
+                WRITEC(c, ']');
+                break;
+            case MILO_OBJECT:
+                WRITEC(c, '{');
+                for (i = 0; i < MILO_OSIZE(v); i++) {
+                    if (i > 0)
+                        WRITEC(c, ',');
+                    milo_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
+                    WRITEC(c, ':');
+                    milo_stringify_cached_value(c, &v->u.o.m[i].v, v, prev, prev_start, start);
+                }
+                WRITEC(c, '}');
+                break;
+            default:
+                milo_stringify_value(c, v);
+        }
+    }
+    v->coff = start - parent_start;
+    v->clen = c->top - start;
+}
+
+const char* milo_stringify_cached(milo_value* v, milo_cache* cache, size_t* length) {
+    milo_context c;
+    assert(v != NULL && cache != NULL);
+    if (cache->json == NULL || v->clen == 0) {
+        c.stack = (char*)malloc(c.size = MILO_PARSE_STRINGIFY_INIT_SIZE);
+        c.top = 0;
+        c.output = MILO_OUTPUT_DYNAMIC;
+        v->coff = 0;
+        milo_stringify_cached_value(&c, v, NULL, cache->json, 0, 0);
+        cache->length = c.top;
+        PUTC(&c, '\0');
+        free(cache->json);
+        cache->json = c.stack;
+    }
+    if (length)
+        *length = cache->length;
+    return cache->json;
+}
+
+void milo_cache_free(milo_cache* cache) {
+    assert(cache != NULL);
+    free(cache->json);
+    cache->json = NULL;
+    cache->length = 0;
+}
+#endif
+
+#ifdef MILO_POSIX
+size_t milo_stringify_iov(const milo_value* v, struct iovec* iov, size_t max, char** scratch) {
+    milo_context c;
+    size_t i, off;
+    assert(v != NULL && iov != NULL && max > 0 && scratch != NULL);
+    c.stack = (char*)malloc(c.size = MILO_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    c.output = MILO_OUTPUT_IOV;
+    c.iov = iov;
+    c.iovcnt = c.seg = 0;
+    c.iovmax = max;
+    milo_stringify_value(&c, v);
+    milo_iov_close(&c);
+    /* Scratch runs were appended in order, so their offsets are a running sum */
+    for (i = off = 0; i < c.iovcnt; i++)
+        if (iov[i].iov_base == NULL) {
+            iov[i].iov_base = c.stack + off;
+            off += iov[i].iov_len;
+        }
+    *scratch = c.stack;
+    return c.iovcnt;
+}
+#endif
+
+size_t milo_stringify_size(const milo_value* v) {
+    return milo_stringify_to(v, NULL, 0);
+}
+
+size_t milo_stringify_to(const milo_value* v, char* buffer, size_t capacity) {
+    milo_context c;
+    assert(v != NULL && (buffer != NULL || capacity == 0));
+    c.stack = buffer;
+    c.size = capacity;
+    c.top = 0;
+    c.output = MILO_OUTPUT_FIXED;
+    milo_stringify_value(&c, v);
+    return c.top;
+}
+
+/*
+ * Binary encoding: every value starts with a tag byte whose high 3 bits hold
+ * the kind and low 5 bits an immediate.  An immediate of 31 means the real
+ * operand follows as a little-endian base-128 varint.
+ *
+ *   SCALAR  imm 0 null, 1 false, 2 true, 3 double (8 bytes, little-endian)
+ *   UINT    integral number n       (0 <= n < 2^53), operand n
+ *   NINT    integral number n       (-2^53 < n < 0), operand -1 - n
+ *   STRING  operand length, then raw bytes
+ *   ARRAY   operand count, then elements
+ *   OBJECT  operand count, then (varint key length, key bytes, value) pairs
+ */
+#define MILO_BIN_SCALAR 0
+#define MILO_BIN_UINT   1
+#define MILO_BIN_NINT   2
+#define MILO_BIN_STRING 3
+#define MILO_BIN_ARRAY  4
+#define MILO_BIN_OBJECT 5
+
+#define MILO_BIN_NULL   0
+#define MILO_BIN_FALSE  1
+#define MILO_BIN_TRUE   2
+#define MILO_BIN_DOUBLE 3
+
+#define MILO_BIN_TAG(kind, imm) ((char)(((kind) << 5) | (imm)))
+#define MILO_BIN_IMM_MAX 31
+#define MILO_BIN_INT_LIMIT 9007199254740992.0 /* 2^53 */
+
+static int milo_is_little_endian(void) {
+    unsigned u = 1;
+    return *(unsigned char*)&u == 1;
+}
+
+static void milo_double_to_le(double n, unsigned char* b) {
+    memcpy(b, &n, 8);
+    if (!milo_is_little_endian()) {
+        int i;
+        for (i = 0; i < 4; i++) {
+            unsigned char t = b[i]; b[i] = b[7 - i]; b[7 - i] = t;
+        }
+    }
+}
+
+static double milo_le_to_double(const unsigned char* p) {
+    unsigned char b[8];
+    double n;
+    int i;
+    for (i = 0; i < 8; i++)
+        b[i] = p[milo_is_little_endian() ? i : 7 - i];
+    memcpy(&n, b, 8);
+    return n;
+}
+
+/* A negative kind writes a bare varint, as used for object key lengths. */
+static void milo_encode_size(milo_context* c, int kind, size_t n) {
+    if (kind >= 0) {
+        if (n < MILO_BIN_IMM_MAX) {
+            PUTC(c, MILO_BIN_TAG(kind, n));
+            return;
+        }
+        PUTC(c, MILO_BIN_TAG(kind, MILO_BIN_IMM_MAX));
+    }
+    while (n >= 0x80) {
+        PUTC(c, (char)(0x80 | (n & 0x7F)));
+        n >>= 7;
+    }
+    PUTC(c, (char)n);
+}
+
+/* n is integral and below 2^53, so every step is exact in double arithmetic */
+static void milo_encode_integer(milo_context* c, int kind, double n) {
+    if (n < MILO_BIN_IMM_MAX) {
+        PUTC(c, MILO_BIN_TAG(kind, (unsigned)n));
+        return;
+    }
+    PUTC(c, MILO_BIN_TAG(kind, MILO_BIN_IMM_MAX));
+    while (n >= 128.0) {
+        double q = floor(n / 128.0);
+        PUTC(c, (char)(0x80 | (unsigned)(n - q * 128.0)));
+        n = q;
+    }
+    PUTC(c, (char)(unsigned)n);
+}
+
+static void milo_encode_number(milo_context* c, double n) {
+    unsigned char b[8];
+    milo_double_to_le(n, b);
+    if (n == floor(n) && n < MILO_BIN_INT_LIMIT && n > -MILO_BIN_INT_LIMIT && !(b[7] & 0x80))
+        milo_encode_integer(c, MILO_BIN_UINT, n);
+    else if (n == floor(n) && n < 0.0 && n > -MILO_BIN_INT_LIMIT)
+        milo_encode_integer(c, MILO_BIN_NINT, -1.0 - n);
+    else {
+        PUTC(c, MILO_BIN_TAG(MILO_BIN_SCALAR, MILO_BIN_DOUBLE));
+        PUTS(c, b, 8);
+    }
+}
+
+static void milo_encode_value(milo_context* c, const milo_value* v) {
+    size_t i;
+    switch (v->type) {
+        case MILO_NULL:   PUTC(c, MILO_BIN_TAG(MILO_BIN_SCALAR, MILO_BIN_NULL)); break;
+        case MILO_FALSE:  PUTC(c, MILO_BIN_TAG(MILO_BIN_SCALAR, MILO_BIN_FALSE)); break;
+        case MILO_TRUE:   PUTC(c, MILO_BIN_TAG(MILO_BIN_SCALAR, MILO_BIN_TRUE)); break;
+        case MILO_NUMBER: milo_encode_number(c, milo_get_number(v)); break;
+        case MILO_STRING:
+            milo_encode_size(c, MILO_BIN_STRING, MILO_SLEN(v));
+            if (MILO_SLEN(v) > 0)
+                PUTS(c, v->u.s.s, MILO_SLEN(v));
+            break;
+        case MILO_ARRAY:
+            milo_encode_size(c, MILO_BIN_ARRAY, MILO_ASIZE(v));
+            for (i = 0; i < MILO_ASIZE(v); i++)
+                if (v->flags & MILO_ARRAY_PACKED)
+                    milo_encode_number(c, v->u.d.n[i]);
+                else
+                    milo_encode_value(c, &v->u.a.e[i]);
+            break;
+        case MILO_OBJECT:
+            milo_encode_size(c, MILO_BIN_OBJECT, MILO_OSIZE(v));
+            for (i = 0; i < MILO_OSIZE(v); i++) {
+                milo_encode_size(c, -1, v->u.o.m[i].klen);
+                if (v->u.o.m[i].klen > 0)
+                    PUTS(c, v->u.o.m[i].k, v->u.o.m[i].klen);
+                milo_encode_value(c, &v->u.o.m[i].v);
+            }
+            break;
+        default: assert(0 && "invalid type");
+    }
+}
+
+char* milo_encode_binary(const milo_value* v, size_t* length) {
+    milo_context c;
+    assert(v != NULL && length != NULL);
+    c.stack = (char*)malloc(c.size = MILO_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    milo_encode_value(&c, v);
+    *length = c.top;
+    return c.stack;
+}
+
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+} milo_bin_reader;
+
+/* Reads the operand of a tag (or of a bare key length when imm is MILO_BIN_IMM_MAX). */
+static int milo_decode_size(milo_bin_reader* r, unsigned imm, size_t* n) {
+    unsigned shift = 0;
+    if (imm < MILO_BIN_IMM_MAX) {
+        *n = imm;
+        return MILO_PARSE_OK;
+    }
+    *n = 0;
+    for (;;) {
+        unsigned char b;
+        if (r->p == r->end || shift >= sizeof(size_t) * 8)
+            return MILO_PARSE_INVALID_VALUE;
+        b = *r->p++;
+        *n |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return MILO_PARSE_OK;
+        shift += 7;
+    }
+}
+
+static int milo_decode_integer(milo_bin_reader* r, unsigned imm, double* n) {
+    double scale = 1.0;
+    int i;
+    if (imm < MILO_BIN_IMM_MAX) {
+        *n = imm;
+        return MILO_PARSE_OK;
+    }
+    *n = 0.0;
+    for (i = 0; i < 8; i++) {
+        unsigned char b;
+        if (r->p == r->end)
+            return MILO_PARSE_INVALID_VALUE;
+        b = *r->p++;
+        *n += (b & 0x7F) * scale;
+        if (!(b & 0x80))
+            return MILO_PARSE_OK;
+        scale *= 128.0;
+    }
+    return MILO_PARSE_INVALID_VALUE;
+}
+
+static int milo_decode_value(milo_bin_reader* r, milo_value* v) {
+    unsigned tag, imm;
+    size_t i, n;
+    double d;
+    int ret;
+    if (r->p == r->end)
+        return MILO_PARSE_EXPECT_VALUE;
+    tag = *r->p++;
+    imm = tag & MILO_BIN_IMM_MAX;
+    switch (tag >> 5) {
+        case MILO_BIN_SCALAR:
+            switch (imm) {
+                case MILO_BIN_NULL:  v->type = MILO_NULL;  return MILO_PARSE_OK;
+                case MILO_BIN_FALSE: v->type = MILO_FALSE; return MILO_PARSE_OK;
+                case MILO_BIN_TRUE:  v->type = MILO_TRUE;  return MILO_PARSE_OK;
+                case MILO_BIN_DOUBLE:
+                    if (r->end - r->p < 8)
+                        return MILO_PARSE_INVALID_VALUE;
+                    milo_set_number(v, milo_le_to_double(r->p));
+                    r->p += 8;
+                    return MILO_PARSE_OK;
+                default: return MILO_PARSE_INVALID_VALUE;
+            }
+        case MILO_BIN_UINT:
+        case MILO_BIN_NINT:
+            if ((ret = milo_decode_integer(r, imm, &d)) != MILO_PARSE_OK)
+                return ret;
+            milo_set_number(v, (tag >> 5) == MILO_BIN_UINT ? d : -1.0 - d);
+            return MILO_PARSE_OK;
+        case MILO_BIN_STRING:
+            if ((ret = milo_decode_size(r, imm, &n)) != MILO_PARSE_OK)
+                return ret;
+            if (!MILO_SIZE_FITS(n))
+                return MILO_PARSE_SIZE_TOO_BIG;
+            if ((size_t)(r->end - r->p) < n)
+                return MILO_PARSE_INVALID_VALUE;
+            milo_set_string(v, (const char*)r->p, n);
+            r->p += n;
+            return MILO_PARSE_OK;
+        case MILO_BIN_ARRAY:
+            if ((ret = milo_decode_size(r, imm, &n)) != MILO_PARSE_OK)
+                return ret;
+            if (!MILO_SIZE_FITS(n))
+                return MILO_PARSE_SIZE_TOO_BIG;
+            if ((size_t)(r->end - r->p) < n) /* every element takes at least one byte */
+                return MILO_PARSE_INVALID_VALUE;
+            v->type = MILO_ARRAY;
+            v->flags = 0;
+            MILO_ASIZE(v) = 0;
+            v->u.a.e = n ? (milo_value*)malloc(n * sizeof(milo_value)) : NULL;
+            for (i = 0; i < n; i++) {
+                milo_init(&v->u.a.e[i]);
+                if ((ret = milo_decode_value(r, &v->u.a.e[i])) != MILO_PARSE_OK) {
+                    milo_free(v);
+                    return ret == MILO_PARSE_EXPECT_VALUE ? MILO_PARSE_INVALID_VALUE : ret;
+                }
+                MILO_ASIZE(v)++;
+            }
+            return MILO_PARSE_OK;
+        case MILO_BIN_OBJECT:
+            if ((ret = milo_decode_size(r, imm, &n)) != MILO_PARSE_OK)
+                return ret;
+            if (!MILO_SIZE_FITS(n))
+                return MILO_PARSE_SIZE_TOO_BIG;
+            if ((size_t)(r->end - r->p) / 2 < n) /* key length and value take at least two bytes */
+                return MILO_PARSE_INVALID_VALUE;
+            v->type = MILO_OBJECT;
+            MILO_OSIZE(v) = 0;
+            v->u.o.m = n ? (milo_member*)malloc(n * sizeof(milo_member)) : NULL;
+            for (i = 0; i < n; i++) {
+                milo_member* m = &v->u.o.m[i];
+                size_t klen;
+                if ((ret = milo_decode_size(r, MILO_BIN_IMM_MAX, &klen)) != MILO_PARSE_OK ||
+                    (size_t)(r->end - r->p) < klen) {
+                    milo_free(v);
+                    return MILO_PARSE_INVALID_VALUE;
+                }
+                memcpy(m->k = (char*)malloc(klen + 1), r->p, klen);
+                m->k[klen] = '\0';
+                m->klen = klen;
+                r->p += klen;
+                milo_init(&m->v);
+                if ((ret = milo_decode_value(r, &m->v)) != MILO_PARSE_OK) {
+                    free(m->k);
+                    milo_free(v);
+                    return ret == MILO_PARSE_EXPECT_VALUE ? MILO_PARSE_INVALID_VALUE : ret;
+                }
+                MILO_OSIZE(v)++;
+            }
+            return MILO_PARSE_OK;
+        default:
+            return MILO_PARSE_INVALID_VALUE;
+    }
+}
+
+int milo_decode_binary(milo_value* v, const char* data, size_t length) {
+    milo_bin_reader r;
+    int ret;
+    assert(v != NULL && (data != NULL || length == 0));
+    r.p = (const unsigned char*)data;
+    r.end = r.p + length;
+    milo_init(v);
+    if ((ret = milo_decode_value(&r, v)) == MILO_PARSE_OK && r.p != r.end) {
+        milo_free(v);
+        ret = MILO_PARSE_ROOT_NOT_SINGULAR;
+    }
+    return ret;
+}
+
+/*
+ * Snapshot image: a header followed by fixed-size nodes.  Every reference is
+ * an offset relative to the node (or member) that holds it, so the image can
+ * be mapped at any address and read in place.  Payloads are 8-byte aligned.
+ */
+#define MILO_SNAPSHOT_MAGIC "MILOSNAP"
+#define MILO_SNAPSHOT_ALIGN 8
+
+struct milo_snapshot_value {
+    union {
+        double n;   /* number */
+        size_t off; /* string, elements or members, relative to this node */
+    }u;
+    size_t size;    /* string length, element count or member count */
+    size_t type;
+};
+
+typedef struct {
+    size_t koff, klen; /* key, relative to this member; key length */
+    milo_snapshot_value v;
+} milo_snapshot_member;
+
+typedef struct {
+    char magic[8];
+    unsigned char abi[8]; /* sizeof(size_t), sizeof(milo_snapshot_value), little endian, version */
+    size_t length;        /* whole image length in bytes */
+    milo_snapshot_value root;
+} milo_snapshot_header;
+
+struct milo_snapshot {
+    const char* base;
+    size_t length;
+    int mapped;
+};
+
+static void milo_snapshot_abi(unsigned char* abi) {
+    memset(abi, 0, 8);
+    abi[0] = (unsigned char)sizeof(size_t);
+    abi[1] = (unsigned char)sizeof(milo_snapshot_value);
+    abi[2] = (unsigned char)milo_is_little_endian();
+    abi[3] = 1;
+}
+
+static size_t milo_snapshot_alloc(milo_context* c, size_t size) {
+    size_t pad = (MILO_SNAPSHOT_ALIGN - c->top % MILO_SNAPSHOT_ALIGN) % MILO_SNAPSHOT_ALIGN;
+    size_t off;
+    if (pad > 0)
+        memset(milo_context_push(c, pad), 0, pad);
+    off = c->top;
+    if (size > 0)
+        memset(milo_context_push(c, size), 0, size);
+    return off;
+}
+
+#define MILO_SNAPSHOT_NODE(c, off) ((milo_snapshot_value*)((c)->stack + (off)))
+#define MILO_SNAPSHOT_MEMBER(c, off) ((milo_snapshot_member*)((c)->stack + (off)))
+
+/* Node pointers are re-derived after every allocation since the buffer may move. */
+static void milo_snapshot_write_value(milo_context* c, size_t node, const milo_value* v) {
+    size_t i, block;
+    MILO_SNAPSHOT_NODE(c, node)->type = v->type;
+    switch (v->type) {
+        case MILO_NUMBER:
+            MILO_SNAPSHOT_NODE(c, node)->u.n = milo_get_number(v);
+            break;
+        case MILO_STRING:
+            block = milo_snapshot_alloc(c, MILO_SLEN(v) + 1);
+            memcpy(c->stack + block, v->u.s.s, MILO_SLEN(v));
+            MILO_SNAPSHOT_NODE(c, node)->u.off = block - node;
+            MILO_SNAPSHOT_NODE(c, node)->size = MILO_SLEN(v);
+            break;
+        case MILO_ARRAY:
+            block = milo_snapshot_alloc(c, MILO_ASIZE(v) * sizeof(milo_snapshot_value));
+            MILO_SNAPSHOT_NODE(c, node)->u.off = block - node;
+            MILO_SNAPSHOT_NODE(c, node)->size = MILO_ASIZE(v);
+            for (i = 0; i < MILO_ASIZE(v); i++)
+                if (v->flags & MILO_ARRAY_PACKED) {
+                    MILO_SNAPSHOT_NODE(c, block + i * sizeof(milo_snapshot_value))->type = MILO_NUMBER;
+                    MILO_SNAPSHOT_NODE(c, block + i * sizeof(milo_snapshot_value))->u.n = v->u.d.n[i];
+                }
+                else
+                    milo_snapshot_write_value(c, block + i * sizeof(milo_snapshot_value), &v->u.a.e[i]);
+            break;
+        case MILO_OBJECT:
+            block = milo_snapshot_alloc(c, MILO_OSIZE(v) * sizeof(milo_snapshot_member));
+            MILO_SNAPSHOT_NODE(c, node)->u.off = block - node;
+            MILO_SNAPSHOT_NODE(c, node)->size = MILO_OSIZE(v);
+            for (i = 0; i < MILO_OSIZE(v); i++) {
+                size_t m = block + i * sizeof(milo_snapshot_member);
+                size_t k = milo_snapshot_alloc(c, v->u.o.m[i].klen + 1);
+                memcpy(c->stack + k, v->u.o.m[i].k, v->u.o.m[i].klen);
+                MILO_SNAPSHOT_MEMBER(c, m)->koff = k - m;
+                MILO_SNAPSHOT_MEMBER(c, m)->klen = v->u.o.m[i].klen;
+                milo_snapshot_write_value(c, m + offsetof(milo_snapshot_member, v), &v->u.o.m[i].v);
+            }
+            break;
+        default: break;
+    }
+}
+
+int milo_snapshot_write(const milo_value* v, const char* path) {
+    milo_context c;
+    milo_snapshot_header* h;
+    FILE* fp;
+    int ret = -1;
+    assert(v != NULL && path != NULL);
+    c.stack = NULL;
+    c.size = c.top = 0;
+    milo_snapshot_alloc(&c, sizeof(milo_snapshot_header));
+    milo_snapshot_write_value(&c, offsetof(milo_snapshot_header, root), v);
+    milo_snapshot_alloc(&c, 0); /* pad the tail so the length stays aligned */
+    h = (milo_snapshot_header*)c.stack;
+    memcpy(h->magic, MILO_SNAPSHOT_MAGIC, 8);
+    milo_snapshot_abi(h->abi);
+    h->length = c.top;
+    if ((fp = fopen(path, "wb")) != NULL) {
+        if (fwrite(c.stack, 1, c.top, fp) == c.top)
+            ret = 0;
+        if (fclose(fp) != 0)
+            ret = -1;
+    }
+    free(c.stack);
+    return ret;
+}
+
+static int milo_snapshot_check(const char* base, size_t length) {
+    const milo_snapshot_header* h = (const milo_snapshot_header*)base;
+    unsigned char abi[8];
+    milo_snapshot_abi(abi);
+    return length >= sizeof(milo_snapshot_header) &&
+        memcmp(h->magic, MILO_SNAPSHOT_MAGIC, 8) == 0 &&
+        memcmp(h->abi, abi, 8) == 0 &&
+        h->length == length;
+}
+
+milo_snapshot* milo_snapshot_open(const char* path) {
+    milo_snapshot* s;
+    assert(path != NULL);
+    s = (milo_snapshot*)malloc(sizeof(milo_snapshot));
+#ifdef MILO_POSIX
+    {
+        struct stat st;
+        void* p = MAP_FAILED;
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+            p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (fd >= 0)
+            close(fd); /* the mapping keeps the file referenced */
+        if (p == MAP_FAILED) {
+            free(s);
+            return NULL;
+        }
+        s->base = (const char*)p;
+        s->length = (size_t)st.st_size;
+        s->mapped = 1;
+    }
+#else
+    {
+        /* No mmap(): fall back to reading the image into one heap block */
+        FILE* fp = fopen(path, "rb");
+        long n = -1;
+        char* buf = NULL;
+        if (fp != NULL && fseek(fp, 0, SEEK_END) == 0 && (n = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+            buf = (char*)malloc((size_t)n);
+            if (fread(buf, 1, (size_t)n, fp) != (size_t)n) {
+                free(buf);
+                buf = NULL;
+            }
+        }
+        if (fp != NULL)
+            fclose(fp);
+        if (buf == NULL) {
+            free(s);
+            return NULL;
+        }
+        s->base = buf;
+        s->length = (size_t)n;
+        s->mapped = 0;
+    }
+#endif
+    if (!milo_snapshot_check(s->base, s->length)) {
+        milo_snapshot_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+void milo_snapshot_close(milo_snapshot* s) {
+    if (s == NULL)
+        return;
+#ifdef MILO_POSIX
+    if (s->mapped)
+        munmap((void*)s->base, s->length);
+#endif
+    if (!s->mapped)
+        free((void*)s->base);
+    free(s);
+}
+
+const milo_snapshot_value* milo_snapshot_root(const milo_snapshot* s) {
+    assert(s != NULL);
+    return &((const milo_snapshot_header*)s->base)->root;
+}
+
+#define MILO_SNAPSHOT_PAYLOAD(v) ((const char*)(v) + (v)->u.off)
+
+milo_type milo_snapshot_get_type(const milo_snapshot_value* v) {
+    assert(v != NULL);
+    return (milo_type)v->type;
+}
+
+int milo_snapshot_get_boolean(const milo_snapshot_value* v) {
+    assert(v != NULL && (v->type == MILO_TRUE || v->type == MILO_FALSE));
+    return v->type == MILO_TRUE;
+}
+
+double milo_snapshot_get_number(const milo_snapshot_value* v) {
+    assert(v != NULL && v->type == MILO_NUMBER);
+    return v->u.n;
+}
+
+const char* milo_snapshot_get_string(const milo_snapshot_value* v) {
+    assert(v != NULL && v->type == MILO_STRING);
+    return MILO_SNAPSHOT_PAYLOAD(v);
+}
+
+size_t milo_snapshot_get_string_length(const milo_snapshot_value* v) {
+    assert(v != NULL && v->type == MILO_STRING);
+    return v->size;
+}
+
+size_t milo_snapshot_get_array_size(const milo_snapshot_value* v) {
+    assert(v != NULL && v->type == MILO_ARRAY);
+    return v->size;
+}
+
+const milo_snapshot_value* milo_snapshot_get_array_element(const milo_snapshot_value* v, size_t index) {
+    assert(v != NULL && v->type == MILO_ARRAY);
+    assert(index < v->size);
+    return (const milo_snapshot_value*)MILO_SNAPSHOT_PAYLOAD(v) + index;
+}
+
+size_t milo_snapshot_get_object_size(const milo_snapshot_value* v) {
+    assert(v != NULL && v->type == MILO_OBJECT);
+    return v->size;
+}
+
+static const milo_snapshot_member* milo_snapshot_member_at(const milo_snapshot_value* v, size_t index) {
+    assert(v != NULL && v->type == MILO_OBJECT);
+    assert(index < v->size);
+    return (const milo_snapshot_member*)MILO_SNAPSHOT_PAYLOAD(v) + index;
+}
+
+const char* milo_snapshot_get_object_key(const milo_snapshot_value* v, size_t index) {
+    const milo_snapshot_member* m = milo_snapshot_member_at(v, index);
+    return (const char*)m + m->koff;
+}
+
+size_t milo_snapshot_get_object_key_length(const milo_snapshot_value* v, size_t index) {
+    return milo_snapshot_member_at(v, index)->klen;
+}
+
+const milo_snapshot_value* milo_snapshot_get_object_value(const milo_snapshot_value* v, size_t index) {
+    return &milo_snapshot_member_at(v, index)->v;
+}
+
+static void milo_free_value(milo_value* v) {
+    size_t  i;
+    switch (v->type) {
+        case MILO_STRING:
+            free(v->u.s.s);
+            break;
+        case MILO_ARRAY:
+            if (v->flags & MILO_ARRAY_PACKED) {
+                free(v->u.d.n);
+                break;
+            }
+            for (i = 0; i < MILO_ASIZE(v); i++)
+                milo_free_value(&v->u.a.e[i]);
+            free(v->u.a.e);
+            break;
+        case MILO_OBJECT:
+            for (i = 0; i < MILO_OSIZE(v); i++) {
+                free(v->u.o.m[i].k);
+                milo_free_value(&v->u.o.m[i].v);
+            }
+            free(v->u.o.m);
+            break;
+        default: break;
+    }
+    v->type = MILO_NULL;
+}
+
+#ifdef MILO_STRINGIFY_CACHE
+/*
+ * Drops the cached text of v and of every enclosing value.  The walk stops at
+ * the first ancestor that is already dirty, as all of its ancestors are too.
+ */
+static void milo_invalidate(milo_value* v) {
+    v->clen = 0;
+    for (v = v->parent; v != NULL && v->clen != 0; v = v->parent)
+        v->clen = 0;
+}
+#endif
+
+void milo_free(milo_value* v) {
+    assert( v!= NULL);
+#ifdef MILO_STRINGIFY_CACHE
+    milo_invalidate(v);
+#endif
+    milo_free_value(v);
+}
+
+#ifdef MILO_POSIX
+/*
+ * Deferred reclamation: detached containers go through a bounded ring to one
+ * background thread, which is started on first use and stopped by
+ * milo_reclaimer_flush().  A full ring makes the caller wait for the next
+ * free slot, which takes at most the time to free one tree.
+ */
+static pthread_mutex_t milo_reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t milo_reclaim_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t milo_reclaim_space = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t milo_reclaim_stopped = PTHREAD_COND_INITIALIZER;
+static pthread_t milo_reclaim_thread;
+static milo_value milo_reclaim_queue[MILO_RECLAIM_QUEUE_SIZE];
+static size_t milo_reclaim_head, milo_reclaim_count;
+static int milo_reclaim_running, milo_reclaim_stop;
+static unsigned long milo_reclaim_stops; /* completed flushes */
+
+static void* milo_reclaimer(void* arg) {
+    milo_value v;
+    (void)arg;
+    pthread_mutex_lock(&milo_reclaim_lock);
+    for (;;) {
+        while (milo_reclaim_count == 0 && !milo_reclaim_stop)
+            pthread_cond_wait(&milo_reclaim_ready, &milo_reclaim_lock);
+        if (milo_reclaim_count == 0)
+            break;
+        v = milo_reclaim_queue[milo_reclaim_head];
+        milo_reclaim_head = (milo_reclaim_head + 1) % MILO_RECLAIM_QUEUE_SIZE;
+        milo_reclaim_count--;
+        pthread_cond_signal(&milo_reclaim_space);
+        pthread_mutex_unlock(&milo_reclaim_lock);
+        milo_free_value(&v);
+        pthread_mutex_lock(&milo_reclaim_lock);
+    }
+    pthread_mutex_unlock(&milo_reclaim_lock);
+    return NULL;
+}
+#endif
+
+void milo_free_deferred(milo_value* v) {
+    assert(v != NULL);
+#ifdef MILO_POSIX
+    if (v->type == MILO_ARRAY || v->type == MILO_OBJECT) {
+        int queued = 0;
+#ifdef MILO_STRINGIFY_CACHE
+        milo_invalidate(v);
+#endif
+        pthread_mutex_lock(&milo_reclaim_lock);
+        if (!milo_reclaim_running && !milo_reclaim_stop)
+            milo_reclaim_running = pthread_create(&milo_reclaim_thread, NULL, milo_reclaimer, NULL) == 0;
+        while (milo_reclaim_running && !milo_reclaim_stop && milo_reclaim_count == MILO_RECLAIM_QUEUE_SIZE)
+            pthread_cond_wait(&milo_reclaim_space, &milo_reclaim_lock);
+        /* nothing is queued once stopping, as the reclaimer may already have drained the ring */
+        if (milo_reclaim_running && !milo_reclaim_stop) {
+            milo_reclaim_queue[(milo_reclaim_head + milo_reclaim_count++) % MILO_RECLAIM_QUEUE_SIZE] = *v;
+            pthread_cond_signal(&milo_reclaim_ready);
+            queued = 1;
+        }
+        pthread_mutex_unlock(&milo_reclaim_lock);
+        if (queued) {
+            v->type = MILO_NULL;
+            return;
+        }
+    }
+#endif
+    milo_free(v); /* scalars and strings are cheap, and a stopping reclaimer takes nothing */
+}
+
+void milo_reclaimer_flush(void) {
+#ifdef MILO_POSIX
+    pthread_mutex_lock(&milo_reclaim_lock);
+    if (milo_reclaim_stop) {
+        /* another flush is joining the thread; a new reclaimer may start right after it */
+        unsigned long stops = milo_reclaim_stops;
+        while (milo_reclaim_stops == stops)
+            pthread_cond_wait(&milo_reclaim_stopped, &milo_reclaim_lock);
+        pthread_mutex_unlock(&milo_reclaim_lock);
+        return;
+    }
+    if (!milo_reclaim_running) {
+        pthread_mutex_unlock(&milo_reclaim_lock);
+        return;
+    }
+    milo_reclaim_stop = 1;
+    pthread_cond_signal(&milo_reclaim_ready);
+    pthread_cond_broadcast(&milo_reclaim_space);
+    pthread_mutex_unlock(&milo_reclaim_lock);
+    pthread_join(milo_reclaim_thread, NULL);
+    pthread_mutex_lock(&milo_reclaim_lock);
+    milo_reclaim_running = milo_reclaim_stop = 0;
+    milo_reclaim_stops++;
+    pthread_cond_broadcast(&milo_reclaim_stopped);
+    pthread_mutex_unlock(&milo_reclaim_lock);
+#endif
+}
+
+milo_type milo_get_type(const milo_value *v) {
+    assert(v != NULL);
+    return v->type;
+}
+
+int milo_get_boolean(const milo_value* v) {
+    assert(v != NULL && (v->type == MILO_TRUE || v->type == MILO_FALSE));
+    return v->type == MILO_TRUE;
+}
+
+void milo_set_boolean(milo_value* v, int b) {
+    milo_free(v);
+    v->type = b ? MILO_TRUE : MILO_FALSE;
+}
+
+double milo_get_number(const milo_value* v) {
+    assert(v != NULL && v->type == MILO_NUMBER);
+    if (v->flags & MILO_NUMBER_LAZY) {
+#ifdef MILO_COMPACT
+        return milo_decode_lexeme(v->u.l.p, v->flags); /* no room to cache the result */
+#else
+        if (!(v->flags & MILO_NUMBER_DECODED)) {
+            milo_value* w = (milo_value*)v; /* caching the decoded value is not a logical change */
+            w->u.l.n = milo_decode_lexeme(v->u.l.p, v->flags);
+            w->flags |= MILO_NUMBER_DECODED;
+        }
+        return v->u.l.n;
+#endif
+    }
+    return v->u.n;
+}
+
+const char* milo_get_number_lexeme(const milo_value* v, size_t* length) {
+    unsigned hint;
+    int safe;
+    assert(v != NULL && v->type == MILO_NUMBER && length != NULL);
+    if (!(v->flags & MILO_NUMBER_LAZY))
+        return NULL;
+    *length = milo_scan_number(v->u.l.p, &hint, &safe) - v->u.l.p;
+    return v->u.l.p;
+}
+
+void milo_set_number(milo_value*v, double n) {
+    milo_free(v);
+    v->u.n = n;
+    v->flags = 0;
+    v->type = MILO_NUMBER;
+}
+
+const char* milo_get_string(const milo_value* v) {
+    assert(v != NULL && v->type == MILO_STRING);
+    return v->u.s.s;
+}
 
 size_t milo_get_string_length(const milo_value* v) {
     assert(v != NULL && v->type == MILO_STRING);
-    return v->u.s.len;
+    return MILO_SLEN(v);
 }
 
 void milo_set_string(milo_value* v, const char* s, size_t len) {
     assert( v!= NULL && ( s != NULL || len == 0));
+    assert(MILO_SIZE_FITS(len));
     milo_free(v);
     v->u.s.s = (char*) malloc(len + 1);
     memcpy(v->u.s.s, s, len);
     v->u.s.s[len] = '\0';
-    v->u.s.len = len;
+    MILO_SLEN(v) = len;
     v->type = MILO_STRING;
 }
 
 size_t milo_get_array_size(const milo_value* v) {
     assert(v!= NULL && v->type == MILO_ARRAY);
-    return v->u.a.size;
+    return MILO_ASIZE(v);
+}
+
+void milo_unpack_array(milo_value* v) {
+    size_t i, size;
+    double* n;
+    milo_value* e;
+    assert(v != NULL && v->type == MILO_ARRAY);
+    if (!(v->flags & MILO_ARRAY_PACKED))
+        return;
+    size = MILO_ASIZE(v);
+    n = v->u.d.n;
+    e = (milo_value*)malloc(size * sizeof(milo_value));
+    for (i = 0; i < size; i++) {
+        milo_init(&e[i]);
+#ifdef MILO_STRINGIFY_CACHE
+        e[i].parent = v; /* the text of v is unchanged */
+#endif
+        e[i].u.n = n[i];
+        e[i].flags = 0;
+        e[i].type = MILO_NUMBER;
+    }
+    free(n);
+    v->u.a.e = e;
+    v->flags = 0;
 }
 
 milo_value* milo_get_array_element(const milo_value* v, size_t index) {
     assert(v!=NULL && v->type == MILO_ARRAY);
-    assert(index < v->u.a.size);
+    assert(!(v->flags & MILO_ARRAY_PACKED)); /* see milo_unpack_array() */
+    assert(index < MILO_ASIZE(v));
     return &v->u.a.e[index];
 }
 
+int milo_get_number_array(const milo_value* v, const double** numbers, size_t* count) {
+    assert(v != NULL && numbers != NULL && count != NULL);
+    if (v->type != MILO_ARRAY || !(v->flags & MILO_ARRAY_PACKED))
+        return 0;
+    *numbers = v->u.d.n;
+    *count = MILO_ASIZE(v);
+    return 1;
+}
+
 size_t milo_get_object_size(const milo_value* v) {
     assert(v != NULL && v->type == MILO_OBJECT);
-    return v->u.o.size;
+    return MILO_OSIZE(v);
 }
 
 const char* milo_get_object_key(const milo_value* v, size_t index) {
     assert(v != NULL && v->type == MILO_OBJECT);
-    assert(index < v->u.o.size);
+    assert(index < MILO_OSIZE(v));
     return v->u.o.m[index].k;
 }
 
 size_t milo_get_object_key_length(const milo_value* v, size_t index) {
     assert(v != NULL && v->type == MILO_OBJECT);
-    assert(index < v->u.o.size);
+    assert(index < MILO_OSIZE(v));
     return v->u.o.m[index].klen;
 }
 
 milo_value* milo_get_object_value(const milo_value* v, size_t index) {
     assert(v != NULL && v->type == MILO_OBJECT);
-    assert(index < v->u.o.size);
+    assert(index < MILO_OSIZE(v));
     return &v->u.o.m[index].v;
-}
\ No newline at end of file
+}
+
+#ifndef MILO_EQUAL_LOCAL_SIZE
+#define MILO_EQUAL_LOCAL_SIZE 64 /* members matched out of order without allocating */
+#endif
+
+/* Element i of an array as a number, or 0 if it is not one; packed arrays stay packed */
+static int milo_element_number(const milo_value* v, size_t i, double* n) {
+    if (v->flags & MILO_ARRAY_PACKED) {
+        *n = v->u.d.n[i];
+        return 1;
+    }
+    if (v->u.a.e[i].type != MILO_NUMBER)
+        return 0;
+    *n = milo_get_number(&v->u.a.e[i]);
+    return 1;
+}
+
+static int milo_equal_key(const milo_member* a, const milo_member* b) {
+    return a->klen == b->klen && memcmp(a->k, b->k, a->klen) == 0;
+}
+
+/*
+ * From the first member out of order, every member of a takes the first
+ * unused member of b with an equal key and value.  Equality is transitive, so
+ * this greedy matching succeeds exactly when the members are equal as
+ * multisets, duplicate keys included.
+ */
+static int milo_equal_members(const milo_value* a, const milo_value* b, unsigned flags) {
+    size_t i, j, from, size = MILO_OSIZE(a);
+    char local[MILO_EQUAL_LOCAL_SIZE], *used = local;
+    const milo_member* m = a->u.o.m, *n = b->u.o.m;
+    int ret = 1;
+    for (from = 0; from < size && milo_equal_key(&m[from], &n[from]); from++)
+        if (!milo_equal(&m[from].v, &n[from].v, flags))
+            break;
+    if (from == size)
+        return 1;
+    if (flags & MILO_EQUAL_KEY_ORDER)
+        return 0;
+    if (size - from > MILO_EQUAL_LOCAL_SIZE)
+        used = (char*)malloc(size - from);
+    memset(used, 0, size - from);
+    for (i = from; i < size && ret; i++) {
+        for (j = from; j < size; j++)
+            if (!used[j - from] && milo_equal_key(&m[i], &n[j]) && milo_equal(&m[i].v, &n[j].v, flags))
+                break;
+        if (j < size)
+            used[j - from] = 1;
+        else
+            ret = 0;
+    }
+    if (used != local)
+        free(used);
+    return ret;
+}
+
+int milo_equal(const milo_value* a, const milo_value* b, unsigned flags) {
+    size_t i;
+    double x, y;
+    assert(a != NULL && b != NULL);
+    if (a == b)
+        return 1;
+    if (a->type != b->type)
+        return 0;
+    switch (a->type) {
+        case MILO_NUMBER:
+            return milo_get_number(a) == milo_get_number(b);
+        case MILO_STRING:
+            return MILO_SLEN(a) == MILO_SLEN(b) && memcmp(a->u.s.s, b->u.s.s, MILO_SLEN(a)) == 0;
+        case MILO_ARRAY:
+            if (MILO_ASIZE(a) != MILO_ASIZE(b))
+                return 0;
+            if ((a->flags & MILO_ARRAY_PACKED) || (b->flags & MILO_ARRAY_PACKED)) {
+                for (i = 0; i < MILO_ASIZE(a); i++)
+                    if (!milo_element_number(a, i, &x) || !milo_element_number(b, i, &y) || x != y)
+                        return 0;
+                return 1;
+            }
+            for (i = 0; i < MILO_ASIZE(a); i++)
+                if (!milo_equal(&a->u.a.e[i], &b->u.a.e[i], flags))
+                    return 0;
+            return 1;
+        case MILO_OBJECT:
+            return MILO_OSIZE(a) == MILO_OSIZE(b) && milo_equal_members(a, b, flags);
+        default:
+            return 1;
+    }
+}
+
+/*
+ * MurmurHash3 (x86, 32-bit) steps on unsigned long, masked so that the result
+ * does not depend on its width.
+ */
+#define MILO_HASH_MASK 0xFFFFFFFFUL
+#define MILO_ROTL32(x, r) ((((x) << (r)) | ((x) >> (32 - (r)))) & MILO_HASH_MASK)
+
+static unsigned long milo_hash_word(unsigned long h, unsigned long k) {
+    k = (k * 0xCC9E2D51UL) & MILO_HASH_MASK;
+    k = MILO_ROTL32(k, 15);
+    k = (k * 0x1B873593UL) & MILO_HASH_MASK;
+    h ^= k;
+    h = MILO_ROTL32(h, 13);
+    return (h * 5 + 0xE6546B64UL) & MILO_HASH_MASK;
+}
+
+static unsigned long milo_hash_final(unsigned long h) {
+    h ^= h >> 16;
+    h = (h * 0x85EBCA6BUL) & MILO_HASH_MASK;
+    h ^= h >> 13;
+    h = (h * 0xC2B2AE35UL) & MILO_HASH_MASK;
+    return h ^ (h >> 16);
+}
+
+/* Four bytes per step, assembled in little-endian order on every target */
+static unsigned long milo_hash_bytes(unsigned long h, const char* s, size_t len) {
+    const unsigned char* p = (const unsigned char*)s;
+    unsigned long k = 0;
+    size_t i;
+    for (i = 0; i + 4 <= len; i += 4)
+        h = milo_hash_word(h, (unsigned long)p[i] | (unsigned long)p[i + 1] << 8 |
+            (unsigned long)p[i + 2] << 16 | (unsigned long)p[i + 3] << 24);
+    switch (len & 3) {
+        case 3: k ^= (unsigned long)p[i + 2] << 16; /* fall through */
+        case 2: k ^= (unsigned long)p[i + 1] << 8;  /* fall through */
+        case 1: k ^= p[i];
+            h ^= (MILO_ROTL32((k * 0xCC9E2D51UL) & MILO_HASH_MASK, 15) * 0x1B873593UL) & MILO_HASH_MASK;
+    }
+    return h ^ (len & MILO_HASH_MASK);
+}
+
+static unsigned long milo_hash_number(double n) {
+    unsigned char b[8];
+    if (n == 0.0)
+        n = 0.0; /* -0 equals 0 */
+    milo_double_to_le(n, b);
+    return milo_hash_final(milo_hash_bytes(MILO_NUMBER, (const char*)b, 8));
+}
+
+unsigned long milo_hash(const milo_value* v) {
+    unsigned long h, sum;
+    size_t i;
+    double n;
+    assert(v != NULL);
+    switch (v->type) {
+        case MILO_NUMBER:
+            return milo_hash_number(milo_get_number(v));
+        case MILO_STRING:
+            return milo_hash_final(milo_hash_bytes(MILO_STRING, v->u.s.s, MILO_SLEN(v)));
+        case MILO_ARRAY:
+            h = MILO_ARRAY;
+            for (i = 0; i < MILO_ASIZE(v); i++)
+                h = milo_hash_word(h, milo_element_number(v, i, &n) ? milo_hash_number(n) : milo_hash(&v->u.a.e[i]));
+            return milo_hash_final(h ^ (MILO_ASIZE(v) & MILO_HASH_MASK));
+        case MILO_OBJECT:
+            /* A sum is independent of the member order */
+            for (i = sum = 0; i < MILO_OSIZE(v); i++) {
+                h = milo_hash_bytes(MILO_OBJECT, v->u.o.m[i].k, v->u.o.m[i].klen);
+                sum = (sum + milo_hash_final(milo_hash_word(h, milo_hash(&v->u.o.m[i].v)))) & MILO_HASH_MASK;
+            }
+            return milo_hash_final(milo_hash_word(MILO_OBJECT, sum) ^ (MILO_OSIZE(v) & MILO_HASH_MASK));
+        default:
+            return milo_hash_final(milo_hash_word(0, (unsigned long)v->type));
+    }
+}
+
+/*
+ * Sequentially consistent atomics for shared documents.  Compilers without
+ * GCC-style builtins or the Windows interlocked functions get plain accesses,
+ * which are only correct when a document is used by a single thread.
+ */
+#if defined(__GNUC__)
+#define MILO_ATOMIC_LOAD(p)             __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define MILO_ATOMIC_STORE(p, v)         __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define MILO_ATOMIC_ADD(p, n)           __atomic_add_fetch(p, n, __ATOMIC_SEQ_CST)
+#define MILO_ATOMIC_EXCHANGE_PTR(p, v)  __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define MILO_ATOMIC_TRYLOCK(p)          (__atomic_exchange_n(p, 1, __ATOMIC_SEQ_CST) == 0)
+#elif defined(_MSC_VER) && defined(_WIN64)
+#define MILO_ATOMIC_LOAD(p)             ((size_t)InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0))
+#define MILO_ATOMIC_STORE(p, v)         InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+#define MILO_ATOMIC_ADD(p, n)           ((size_t)InterlockedAdd64((volatile LONG64*)(p), (LONG64)(n)))
+#define MILO_ATOMIC_EXCHANGE_PTR(p, v)  InterlockedExchangePointer((PVOID volatile*)(p), v)
+#define MILO_ATOMIC_TRYLOCK(p)          (InterlockedExchange64((volatile LONG64*)(p), 1) == 0)
+#elif defined(_MSC_VER)
+#define MILO_ATOMIC_LOAD(p)             ((size_t)InterlockedCompareExchange((volatile LONG*)(p), 0, 0))
+#define MILO_ATOMIC_STORE(p, v)         InterlockedExchange((volatile LONG*)(p), (LONG)(v))
+#define MILO_ATOMIC_ADD(p, n)           ((size_t)InterlockedExchangeAdd((volatile LONG*)(p), (LONG)(n)) + (n))
+#define MILO_ATOMIC_EXCHANGE_PTR(p, v)  InterlockedExchangePointer((PVOID volatile*)(p), v)
+#define MILO_ATOMIC_TRYLOCK(p)          (InterlockedExchange((volatile LONG*)(p), 1) == 0)
+#else
+#define MILO_ATOMIC_LOAD(p)             (*(p))
+#define MILO_ATOMIC_STORE(p, v)         (*(p) = (v))
+#define MILO_ATOMIC_ADD(p, n)           (*(p) += (n))
+#define MILO_ATOMIC_EXCHANGE_PTR(p, v)  milo_exchange_ptr((void* volatile*)(p), v)
+#define MILO_ATOMIC_TRYLOCK(p)          (*(p) == 0 ? (*(p) = 1) : 0)
+static void* milo_exchange_ptr(void* volatile* p, void* v) {
+    void* old = *p;
+    *p = v;
+    return old;
+}
+#endif
+
+#if defined(MILO_POSIX)
+#define MILO_YIELD() sched_yield()
+#elif defined(_MSC_VER)
+#define MILO_YIELD() SwitchToThread()
+#else
+#define MILO_YIELD() ((void)0)
+#endif
+
+struct milo_doc {
+    volatile size_t refs;
+    milo_value root;
+};
+
+/* Decodes everything that is otherwise decoded on first read, so readers never write */
+static void milo_freeze(milo_value* v) {
+    size_t i;
+    switch (v->type) {
+        case MILO_NUMBER:
+            milo_get_number(v);
+            break;
+        case MILO_ARRAY:
+            if (!(v->flags & MILO_ARRAY_PACKED))
+                for (i = 0; i < MILO_ASIZE(v); i++)
+                    milo_freeze(&v->u.a.e[i]);
+            break;
+        case MILO_OBJECT:
+            for (i = 0; i < MILO_OSIZE(v); i++)
+                milo_freeze(&v->u.o.m[i].v);
+            break;
+        default: break;
+    }
+}
+
+milo_doc* milo_doc_create(milo_value* v) {
+    milo_doc* d;
+    assert(v != NULL);
+    d = (milo_doc*)malloc(sizeof(milo_doc));
+    d->refs = 1;
+    memcpy(&d->root, v, sizeof(milo_value));
+    v->type = MILO_NULL; /* the tree now belongs to the document */
+#ifdef MILO_STRINGIFY_CACHE
+    milo_invalidate(v);
+    d->root.parent = NULL;
+#endif
+    milo_freeze(&d->root);
+    return d;
+}
+
+milo_doc* milo_doc_retain(milo_doc* d) {
+    assert(d != NULL);
+    MILO_ATOMIC_ADD(&d->refs, 1);
+    return d;
+}
+
+void milo_doc_release(milo_doc* d) {
+    if (d != NULL && MILO_ATOMIC_ADD(&d->refs, (size_t)-1) == 0) {
+        milo_free(&d->root);
+        free(d);
+    }
+}
+
+const milo_value* milo_doc_root(const milo_doc* d) {
+    assert(d != NULL);
+    return &d->root;
+}
+
+size_t milo_doc_refs(const milo_doc* d) {
+    assert(d != NULL);
+    return MILO_ATOMIC_LOAD(&((milo_doc*)d)->refs);
+}
+
+void milo_doc_slot_init(milo_doc_slot* s, milo_doc* d) {
+    assert(s != NULL);
+    s->doc = d ? milo_doc_retain(d) : NULL;
+    s->readers[0] = s->readers[1] = 0;
+    s->index = 0;
+    s->writer = 0;
+}
+
+/*
+ * A reader announces itself on the counter selected by index before loading
+ * the document, and re-checks index so that a concurrent store() is sure to
+ * wait for it.  Readers never block; only stores wait for the announced
+ * readers of the previous index to take their references.
+ */
+milo_doc* milo_doc_slot_acquire(milo_doc_slot* s) {
+    milo_doc* d;
+    size_t i;
+    assert(s != NULL);
+    for (;;) {
+        i = MILO_ATOMIC_LOAD(&s->index);
+        MILO_ATOMIC_ADD(&s->readers[i], 1);
+        if (MILO_ATOMIC_LOAD(&s->index) == i)
+            break;
+        MILO_ATOMIC_ADD(&s->readers[i], (size_t)-1);
+    }
+    d = (milo_doc*)MILO_ATOMIC_LOAD(&s->doc);
+    if (d != NULL)
+        milo_doc_retain(d);
+    MILO_ATOMIC_ADD(&s->readers[i], (size_t)-1);
+    return d;
+}
+
+void milo_doc_slot_store(milo_doc_slot* s, milo_doc* d) {
+    milo_doc* old;
+    size_t i;
+    assert(s != NULL);
+    while (!MILO_ATOMIC_TRYLOCK(&s->writer))
+        MILO_YIELD(); /* stores are serialized, readers are not affected */
+    old = (milo_doc*)MILO_ATOMIC_EXCHANGE_PTR(&s->doc, d ? milo_doc_retain(d) : NULL);
+    i = MILO_ATOMIC_LOAD(&s->index);
+    MILO_ATOMIC_STORE(&s->index, 1 - i);
+    while (MILO_ATOMIC_LOAD(&s->readers[i]) != 0)
+        MILO_YIELD(); /* readers that may have seen old are about to retain it */
+    MILO_ATOMIC_STORE(&s->writer, 0);
+    milo_doc_release(old);
+}
+
+void milo_doc_slot_free(milo_doc_slot* s) {
+    assert(s != NULL);
+    milo_doc_release(s->doc);
+    s->doc = NULL;
+}
@@ -2,6 +2,14 @@
 #define  MILOJSON_H__
 
 #include <stddef.h> /* size_t */
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h> /* struct iovec */
+#define MILO_HAS_IOV
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef enum {
     MILO_NULL,
@@ -15,16 +23,52 @@ typedef enum {
 
 typedef struct milo_value milo_value;
 typedef struct milo_member milo_member;
+typedef struct milo_doc milo_doc;
+typedef struct milo_snapshot milo_snapshot;
+typedef struct milo_snapshot_value milo_snapshot_value;
+
+#if defined(MILO_COMPACT) && defined(MILO_STRINGIFY_CACHE)
+#error "MILO_COMPACT and MILO_STRINGIFY_CACHE cannot be combined"
+#endif
 
+#ifdef MILO_COMPACT
+/*
+ * Compact layout: 16 bytes on 64-bit targets instead of 24.  Counts and
+ * string lengths share one unsigned field and are limited to UINT_MAX (the
+ * parsers return MILO_PARSE_SIZE_TOO_BIG beyond it), and lazily parsed
+ * numbers are decoded on every access.
+ */
+struct milo_value {
+    union {
+        struct { milo_member* m; }o; /* object: members */
+        struct { milo_value* e; }a;  /* array:  elements */
+        struct { double* n; }d;      /* packed array: elements as numbers */
+        struct { char* s; }s;        /* string: null-terminated string */
+        struct { const char* p; }l;  /* lazy number: source lexeme */
+        double n;                    /* number */
+    }u;
+    unsigned size;                   /* member count, element count or string length */
+    unsigned char type;              /* milo_type */
+    unsigned char flags;             /* number: lazy decoding state, array: packed */
+};
+#else
 struct milo_value {
     union {
         struct { milo_member* m; size_t  size; }o; /* object: members, member count */
         struct { milo_value* e; size_t size; }a; /* array:  elements, element count */
+        struct { double* n; size_t size; }d; /* packed array: elements as numbers, element count */
         struct { char* s; size_t len; }s;  /* string: null-terminated string, string length */
+        struct { const char* p; double n; }l; /* lazy number: source lexeme, decoded number */
         double n;                          /* number */
     }u;
     milo_type type;
+    unsigned flags;                        /* number: lazy decoding state, array: packed */
+#ifdef MILO_STRINGIFY_CACHE
+    milo_value* parent; /* enclosing value, as of the last milo_stringify_cached() */
+    size_t coff, clen;  /* cached text: offset from the parent's text, length (0 if dirty) */
+#endif
 };
+#endif
 
 struct milo_member {
     char* k; size_t klen; /* member key string, key string length */
@@ -45,15 +89,140 @@ enum {
     MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
     MILO_PARSE_MISS_KEY,
     MILO_PARSE_MISS_COLON,
-    MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+    MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+    MILO_PARSE_INVALID_UTF8,
+    MILO_PARSE_END, /* milo_parse_next(): no more documents */
+    MILO_PARSE_SIZE_TOO_BIG /* MILO_COMPACT: a length or count exceeds UINT_MAX */
+};
+
+/* Options for milo_parse_ex(), may be combined */
+enum {
+    MILO_PARSE_OPT_VALIDATE_UTF8 = 1 << 0, /* reject strings that are not well-formed UTF-8 */
+    /*
+     * Keep numbers as slices of the input, decoded on first milo_get_number()
+     * and written back verbatim by stringify.  The input must outlive the value.
+     */
+    MILO_PARSE_OPT_LAZY_NUMBERS = 1 << 1,
+    /*
+     * Parse into the existing value instead of a fresh one: strings, arrays
+     * and objects are reparsed in place, position by position, and their
+     * buffers resized with realloc().  For milo_parse_ex() and
+     * milo_parse_next(); the value must be initialized.
+     */
+    MILO_PARSE_OPT_RECYCLE = 1 << 2,
+    /*
+     * Store arrays whose elements are all numbers as a plain double block,
+     * see milo_get_number_array() and milo_unpack_array().  Such numbers are
+     * decoded eagerly even with MILO_PARSE_OPT_LAZY_NUMBERS.
+     */
+    MILO_PARSE_OPT_PACK_NUMBERS = 1 << 3
 };
 
+#ifdef MILO_STRINGIFY_CACHE
+#define milo_init(v) do { (v)->type = MILO_NULL; (v)->parent = NULL; (v)->coff = (v)->clen = 0; } while(0)
+#else
 #define milo_init(v) do { (v)->type = MILO_NULL; } while(0)
+#endif
 
 int milo_parse(milo_value *value, const char *json);
+int milo_parse_ex(milo_value* value, const char* json, unsigned flags);
+/*
+ * Parses only the values selected by JSON Pointer paths such as "/user/id".
+ * A "*" segment matches any member or element and "" the whole document.
+ * The rest is validated but skipped; unselected members and elements are
+ * left out of their containers.
+ */
+int milo_parse_projected(milo_value* value, const char* json, const char* const* paths, size_t count, unsigned flags);
+
+/*
+ * Checks that json[0, len) is one well-formed UTF-8 JSON text without
+ * building a value or allocating.  Returns the code milo_parse_ex() with
+ * MILO_PARSE_OPT_VALIDATE_UTF8 would, and sets *err_offset (if not NULL) to
+ * the byte where the error was found, or to len on success.
+ */
+int milo_validate(const char* json, size_t len, size_t* err_offset);
+
+/*
+ * Rewrite json[0, len) in one pass without building values: minify drops all
+ * whitespace, prettify puts every member and element on its own line indented
+ * by indent spaces per level.  Strings and numbers are copied verbatim.  The
+ * input is validated as by milo_validate() and output is passed to write in
+ * chunks; on error the output written so far is incomplete.
+ */
+typedef void (*milo_writer)(void* context, const char* data, size_t length);
+int milo_minify(const char* json, size_t len, milo_writer write, void* context, size_t* err_offset);
+int milo_prettify(const char* json, size_t len, unsigned indent, milo_writer write, void* context, size_t* err_offset);
+
+/*
+ * Iterates over concatenated documents in one null-terminated buffer, which
+ * may be separated by whitespace or RFC 7464 record separators (0x1E).  The
+ * parse stack is kept across documents.  After MILO_PARSE_OK, offset is the
+ * end of the document just parsed; after an error it is left at the start of
+ * the failed document.
+ */
+typedef struct {
+    const char* json;
+    size_t offset;
+    unsigned flags;
+    char* stack;
+    size_t size;
+} milo_iter;
+
+void milo_iter_init(milo_iter* it, const char* json, unsigned flags);
+int milo_parse_next(milo_iter* it, milo_value* value); /* MILO_PARSE_END once all are consumed */
+void milo_iter_free(milo_iter* it);
+
 char* milo_stringify(const milo_value* v, size_t* length);
+/*
+ * Writes the same text as milo_stringify() into a caller-owned buffer without
+ * allocating and without a terminating null.  Returns the full length; the
+ * output is complete only if that is not greater than capacity.
+ */
+size_t milo_stringify_to(const milo_value* v, char* buffer, size_t capacity);
+#ifdef MILO_HAS_IOV
+/*
+ * Fills at most max entries of iov with the same text as milo_stringify(), for
+ * writev().  Clean string runs of MILO_STRINGIFY_IOV_MIN_REF bytes or more are
+ * referenced in place and stay valid while v is unchanged; everything else is
+ * written to *scratch, to be released with free() after the write.  Returns
+ * the number of entries used.
+ */
+size_t milo_stringify_iov(const milo_value* v, struct iovec* iov, size_t max, char** scratch);
+#endif
+size_t milo_stringify_size(const milo_value* v); /* exact length, no allocation */
+
+#ifdef MILO_STRINGIFY_CACHE
+/*
+ * Incremental stringify.  Every value remembers where its text sits in the
+ * previous output held by the cache; milo_free() and the milo_set_*()
+ * functions mark the value and its ancestors dirty, and the next call only
+ * formats dirty values and copies the rest.  Use one cache per tree and do
+ * not move values of a tracked tree between calls.  The returned text is
+ * owned by the cache and stays valid until the next call.
+ */
+typedef struct {
+    char* json;
+    size_t length;
+} milo_cache;
+
+#define milo_cache_init(cache) do { (cache)->json = NULL; (cache)->length = 0; } while(0)
+const char* milo_stringify_cached(milo_value* v, milo_cache* cache, size_t* length);
+void milo_cache_free(milo_cache* cache);
+#endif
+
+char* milo_encode_binary(const milo_value* v, size_t* length);
+int milo_decode_binary(milo_value* v, const char* data, size_t length);
 
 void milo_free(milo_value* v);
+/*
+ * Like milo_free(), but arrays and objects are handed to a background thread
+ * and v is null on return.  When the queue is full the caller waits for a
+ * free slot.  Falls back to milo_free() while milo_reclaimer_flush() runs or
+ * when threads are unavailable.  milo_reclaimer_flush() waits until every
+ * deferred tree is freed and stops the thread, e.g. before exit.
+ */
+void milo_free_deferred(milo_value* v);
+void milo_reclaimer_flush(void);
 
 milo_type milo_get_type(const milo_value *v);
 
@@ -64,17 +233,98 @@ void milo_set_boolean(milo_value* v, int b);
 
 double milo_get_number(const milo_value *v);
 void milo_set_number(milo_value* v, double n);
+/* Source text of a lazily parsed number, or NULL once it was set or if parsed eagerly */
+const char* milo_get_number_lexeme(const milo_value* v, size_t* length);
 
 const char* milo_get_string(const milo_value* v);
 size_t milo_get_string_length(const milo_value* v);
 void milo_set_string(milo_value* v, const char* s, size_t len);
 
 size_t milo_get_array_size(const milo_value* v);
-milo_value* milo_get_array_element(const milo_value* v, size_t index);
+milo_value* milo_get_array_element(const milo_value* v, size_t index); /* v must not be packed */
+/*
+ * Points *numbers at the elements of a packed array and sets *count.  Returns
+ * 0, leaving both untouched, if v is not packed.
+ */
+int milo_get_number_array(const milo_value* v, const double** numbers, size_t* count);
+/*
+ * Replaces the number block of a packed array by regular elements, e.g.
+ * before milo_get_array_element(); pointers from milo_get_number_array()
+ * become invalid.  Does nothing if v is not packed.
+ */
+void milo_unpack_array(milo_value* v);
 
 size_t milo_get_object_size(const milo_value* v);
 const char* milo_get_object_key(const milo_value* v, size_t index);
 size_t milo_get_object_key_length(const milo_value* v, size_t index);
 milo_value* milo_get_object_value(const milo_value* v, size_t index);
 
+/* Options for milo_equal() */
+enum {
+    MILO_EQUAL_KEY_ORDER = 1 << 0 /* members must also be in the same order */
+};
+
+/*
+ * Deep comparison.  Numbers compare by value, so 0 equals -0, and by default
+ * objects are equal when they hold the same members in any order.
+ * milo_hash() is a 32-bit structural hash consistent with milo_equal() under
+ * either option; object members are combined independently of their order.
+ */
+int milo_equal(const milo_value* a, const milo_value* b, unsigned flags);
+unsigned long milo_hash(const milo_value* v);
+
+/*
+ * Snapshots are position-independent images of a value tree.  An opened
+ * snapshot is memory-mapped where the platform supports it and read in place
+ * without parsing or allocation; images are trusted and must come from
+ * milo_snapshot_write() on a machine with the same word size and byte order.
+ */
+int milo_snapshot_write(const milo_value* v, const char* path); /* 0 on success */
+milo_snapshot* milo_snapshot_open(const char* path); /* NULL on failure */
+void milo_snapshot_close(milo_snapshot* s);
+
+const milo_snapshot_value* milo_snapshot_root(const milo_snapshot* s);
+milo_type milo_snapshot_get_type(const milo_snapshot_value* v);
+int milo_snapshot_get_boolean(const milo_snapshot_value* v);
+double milo_snapshot_get_number(const milo_snapshot_value* v);
+const char* milo_snapshot_get_string(const milo_snapshot_value* v);
+size_t milo_snapshot_get_string_length(const milo_snapshot_value* v);
+size_t milo_snapshot_get_array_size(const milo_snapshot_value* v);
+const milo_snapshot_value* milo_snapshot_get_array_element(const milo_snapshot_value* v, size_t index);
+size_t milo_snapshot_get_object_size(const milo_snapshot_value* v);
+const char* milo_snapshot_get_object_key(const milo_snapshot_value* v, size_t index);
+size_t milo_snapshot_get_object_key_length(const milo_snapshot_value* v, size_t index);
+const milo_snapshot_value* milo_snapshot_get_object_value(const milo_snapshot_value* v, size_t index);
+
+/*
+ * Immutable shared documents.  milo_doc_create() takes over a value tree
+ * (leaving v null) and freezes it; the root may then be read from any number
+ * of threads.  The document is freed when the last reference is released.
+ */
+milo_doc* milo_doc_create(milo_value* v);
+milo_doc* milo_doc_retain(milo_doc* d);
+void milo_doc_release(milo_doc* d);
+const milo_value* milo_doc_root(const milo_doc* d);
+size_t milo_doc_refs(const milo_doc* d); /* a snapshot of the reference count */
+
+/*
+ * An atomically replaceable document for hot reloads.  acquire() returns a
+ * retained document (or NULL) without locking; store() publishes a new
+ * version, waits only for readers in the middle of acquire() and releases the
+ * previous one.  The slot keeps its own reference to the current document.
+ */
+typedef struct {
+    milo_doc* volatile doc;
+    volatile size_t readers[2], index, writer;
+} milo_doc_slot;
+
+void milo_doc_slot_init(milo_doc_slot* s, milo_doc* d);
+milo_doc* milo_doc_slot_acquire(milo_doc_slot* s);
+void milo_doc_slot_store(milo_doc_slot* s, milo_doc* d);
+void milo_doc_slot_free(milo_doc_slot* s);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* MILOJSON_H__ */
\ No newline at end of file
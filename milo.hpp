@@ -0,0 +1,577 @@
+#ifndef  MILOJSON_HPP__
+#define  MILOJSON_HPP__
+
+/*
+ * C++17 wrapper over milo.h.  Everything is inline and forwards to the C API;
+ * nothing here allocates or copies strings.  With C++20, static_document also
+ * parses JSON literals at compile time.
+ */
+
+#include "milo.h"
+#include <cstddef>     /* std::size_t, std::ptrdiff_t */
+#include <iterator>    /* std::forward_iterator_tag */
+#include <string_view> /* std::string_view */
+#include <type_traits> /* std::is_same_v, std::is_arithmetic_v */
+
+namespace milo {
+
+class value_ref;
+
+struct member {
+    std::string_view key;
+    const milo_value* value_ptr;
+    value_ref value() const noexcept;
+};
+
+/* Index-based so that it only relies on the C accessors. */
+template <class T, T (*At)(const milo_value*, std::size_t)>
+class index_iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = T;
+
+    index_iterator(const milo_value* v, std::size_t i) noexcept : v_(v), i_(i) {}
+    T operator*() const noexcept { return At(v_, i_); }
+    index_iterator& operator++() noexcept { ++i_; return *this; }
+    index_iterator operator++(int) noexcept { index_iterator t(*this); ++i_; return t; }
+    bool operator==(const index_iterator& o) const noexcept { return i_ == o.i_ && v_ == o.v_; }
+    bool operator!=(const index_iterator& o) const noexcept { return !(*this == o); }
+
+private:
+    const milo_value* v_;
+    std::size_t i_;
+};
+
+template <class It>
+class range {
+public:
+    range(It b, It e) noexcept : b_(b), e_(e) {}
+    It begin() const noexcept { return b_; }
+    It end() const noexcept { return e_; }
+
+private:
+    It b_, e_;
+};
+
+/* A non-owning, read-only view of a value; valid as long as the value is. */
+class value_ref {
+    static value_ref element_at(const milo_value* v, std::size_t i) noexcept {
+        return value_ref(milo_get_array_element(v, i));
+    }
+    static member member_at(const milo_value* v, std::size_t i) noexcept {
+        return member{ std::string_view(milo_get_object_key(v, i), milo_get_object_key_length(v, i)),
+            milo_get_object_value(v, i) };
+    }
+
+public:
+    constexpr explicit value_ref(const milo_value* v) noexcept : v_(v) {}
+
+    milo_type type() const noexcept { return milo_get_type(v_); }
+    bool is_null() const noexcept { return type() == MILO_NULL; }
+    bool is_boolean() const noexcept { return type() == MILO_TRUE || type() == MILO_FALSE; }
+    bool is_number() const noexcept { return type() == MILO_NUMBER; }
+    bool is_string() const noexcept { return type() == MILO_STRING; }
+    bool is_array() const noexcept { return type() == MILO_ARRAY; }
+    bool is_object() const noexcept { return type() == MILO_OBJECT; }
+
+    bool get_boolean() const noexcept { return milo_get_boolean(v_) != 0; }
+    double get_number() const noexcept { return milo_get_number(v_); }
+    std::string_view get_string() const noexcept {
+        return std::string_view(milo_get_string(v_), milo_get_string_length(v_));
+    }
+
+    /* get<bool>(), get<int>() etc., get<std::string_view>() or get<value_ref>() */
+    template <class T>
+    T get() const noexcept {
+        if constexpr (std::is_same_v<T, bool>)
+            return get_boolean();
+        else if constexpr (std::is_arithmetic_v<T>)
+            return static_cast<T>(get_number());
+        else if constexpr (std::is_same_v<T, std::string_view>)
+            return get_string();
+        else if constexpr (std::is_same_v<T, value_ref>)
+            return *this;
+        else
+            static_assert(sizeof(T) == 0, "milo::value_ref::get<T>: unsupported type");
+    }
+
+    /* Arrays; element access needs milo_unpack_array() on packed arrays first */
+    std::size_t size() const noexcept { return milo_get_array_size(v_); }
+    bool is_packed() const noexcept { const double* n; std::size_t c; return milo_get_number_array(v_, &n, &c) != 0; }
+    /* The number block of a packed array, empty otherwise */
+    range<const double*> numbers() const noexcept {
+        const double* n = nullptr;
+        std::size_t c = 0;
+        milo_get_number_array(v_, &n, &c);
+        return range<const double*>(n, n + c);
+    }
+    value_ref operator[](std::size_t index) const noexcept { return value_ref(milo_get_array_element(v_, index)); }
+
+    using element_iterator = index_iterator<value_ref, &value_ref::element_at>;
+    range<element_iterator> elements() const noexcept {
+        return range<element_iterator>(element_iterator(v_, 0), element_iterator(v_, size()));
+    }
+
+    /* Objects */
+    std::size_t member_count() const noexcept { return milo_get_object_size(v_); }
+    std::string_view key(std::size_t index) const noexcept {
+        return std::string_view(milo_get_object_key(v_, index), milo_get_object_key_length(v_, index));
+    }
+    value_ref value(std::size_t index) const noexcept { return value_ref(milo_get_object_value(v_, index)); }
+
+    using member_iterator = index_iterator<member, &value_ref::member_at>;
+    range<member_iterator> members() const noexcept {
+        return range<member_iterator>(member_iterator(v_, 0), member_iterator(v_, member_count()));
+    }
+
+    constexpr const milo_value* c_value() const noexcept { return v_; }
+
+private:
+    const milo_value* v_;
+};
+
+inline value_ref member::value() const noexcept { return value_ref(value_ptr); }
+
+/* Owns a value tree and frees it with milo_free(); move-only. */
+class document {
+public:
+    document() noexcept { milo_init(&v_); }
+    ~document() { milo_free(&v_); }
+
+    document(document&& o) noexcept : v_(o.v_) {
+        milo_init(&o.v_);
+        adopt();
+    }
+    document& operator=(document&& o) noexcept {
+        if (this != &o) {
+            milo_free(&v_);
+            v_ = o.v_;
+            milo_init(&o.v_);
+            adopt();
+        }
+        return *this;
+    }
+    document(const document&) = delete;
+    document& operator=(const document&) = delete;
+
+    /* Returns a MILO_PARSE_* code; the document is null on failure */
+    int parse(const char* json, unsigned flags = 0) noexcept {
+        if (!(flags & MILO_PARSE_OPT_RECYCLE)) /* recycling reuses the old tree and releases it on error */
+            milo_free(&v_);
+        return milo_parse_ex(&v_, json, flags);
+    }
+
+    value_ref root() const noexcept { return value_ref(&v_); }
+    milo_value* c_value() noexcept { return &v_; }
+    const milo_value* c_value() const noexcept { return &v_; }
+
+private:
+    /* Children cache a pointer to their parent for incremental stringify */
+    void adopt() noexcept {
+#ifdef MILO_STRINGIFY_CACHE
+        std::size_t i;
+        const double* numbers;
+        v_.parent = NULL;
+        v_.clen = 0;
+        if (v_.type == MILO_ARRAY && !milo_get_number_array(&v_, &numbers, &i))
+            for (i = 0; i < v_.u.a.size; i++)
+                v_.u.a.e[i].parent = &v_;
+        else if (v_.type == MILO_OBJECT)
+            for (i = 0; i < v_.u.o.size; i++)
+                v_.u.o.m[i].v.parent = &v_;
+#endif
+    }
+
+    milo_value v_;
+};
+
+#if __cplusplus >= 202002L
+namespace detail {
+
+/* Not constexpr: reaching it while parsing a literal fails the build with this call in the message */
+inline void invalid_static_json(const char* /* reason */) noexcept {}
+
+template <std::size_t Values, std::size_t Members, std::size_t Chars>
+struct static_tables {
+    milo_value values[Values];
+    milo_member members[Members + 1]; /* never empty */
+    char chars[Chars + 1];
+};
+
+/*
+ * Recursive descent over the literal.  Without out it only advances and
+ * counts; with it, it fills *out with pointers into *self, the static object
+ * that *out is returned into.  Blocks are allocated in parse order.
+ */
+template <class Tables>
+class static_parser {
+public:
+    std::size_t values = 0, members = 0, chars = 0;
+
+    constexpr static_parser(std::string_view json, Tables* out, const Tables* self) noexcept
+        : p_(json.data()), end_(json.data() + json.size()), out_(out), self_(self) {}
+
+    constexpr void document() {
+        whitespace();
+        values++; /* the root is values[0] */
+        value(out_ ? &out_->values[0] : nullptr);
+        whitespace();
+        if (p_ != end_)
+            invalid_static_json("root not singular");
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+    Tables* out_;
+    const Tables* self_;
+
+    constexpr char peek() const noexcept { return p_ == end_ ? '\0' : *p_; }
+
+    constexpr void whitespace() noexcept {
+        while (peek() == ' ' || peek() == '\t' || peek() == '\n' || peek() == '\r')
+            p_++;
+    }
+
+    constexpr void literal(const char* s) {
+        for (; *s; s++, p_++)
+            if (peek() != *s)
+                invalid_static_json("invalid value");
+    }
+
+    constexpr void value(milo_value* v) {
+        switch (peek()) {
+            case 'n': literal("null");  if (v) v->type = MILO_NULL;  break;
+            case 't': literal("true");  if (v) v->type = MILO_TRUE;  break;
+            case 'f': literal("false"); if (v) v->type = MILO_FALSE; break;
+            case '"': {
+                std::size_t head = chars, len = string();
+                if (v) {
+                    v->type = MILO_STRING;
+                    v->u.s.s = const_cast<char*>(&self_->chars[head]);
+#ifdef MILO_COMPACT
+                    v->size = static_cast<unsigned>(len);
+#else
+                    v->u.s.len = len;
+#endif
+                }
+                break;
+            }
+            case '[': array(v); break;
+            case '{': object(v); break;
+            case '\0': invalid_static_json("expect value"); break;
+            default: {
+                double n = number();
+                if (v) {
+                    v->type = MILO_NUMBER;
+                    v->u.n = n;
+                }
+            }
+        }
+    }
+
+    static constexpr bool digit(char ch) noexcept { return ch >= '0' && ch <= '9'; }
+
+    /*
+     * Only numbers that one correctly rounded multiplication or division
+     * yields are accepted: significand up to 2^53, power of ten up to 10^22.
+     * Anything else would need strtod() to round exactly as milo_parse() does.
+     */
+    constexpr double number() {
+        const unsigned long long limit = 1ULL << 53;
+        unsigned long long d = 0;
+        long e = 0, x = 0;
+        int digits = 0;
+        bool negative = peek() == '-', inexact = false;
+        double n, scale = 1.0;
+        if (negative) p_++;
+        if (peek() == '0') p_++;
+        else if (peek() >= '1' && peek() <= '9') {
+            for (; digit(peek()); p_++)
+                if (digits < 19) {
+                    d = d * 10 + (*p_ - '0');
+                    digits++;
+                }
+                else {
+                    inexact |= *p_ != '0';
+                    e++;
+                }
+        }
+        else
+            invalid_static_json("invalid value");
+        if (peek() == '.') {
+            p_++;
+            if (!digit(peek()))
+                invalid_static_json("invalid value");
+            for (; digit(peek()); p_++)
+                if (digits < 19) {
+                    d = d * 10 + (*p_ - '0');
+                    digits += d != 0; /* leading zeros are not significant */
+                    e--;
+                }
+                else
+                    inexact |= *p_ != '0';
+        }
+        if (peek() == 'e' || peek() == 'E') {
+            bool minus;
+            p_++;
+            minus = peek() == '-';
+            if (peek() == '+' || peek() == '-') p_++;
+            if (!digit(peek()))
+                invalid_static_json("invalid value");
+            for (; digit(peek()); p_++)
+                if (x < 100000)
+                    x = x * 10 + (*p_ - '0');
+            e += minus ? -x : x;
+        }
+        if (d == 0)
+            return negative ? -0.0 : 0.0;
+        for (; e > 22 && d <= limit / 10; e--)
+            d *= 10;
+        if (inexact || d > limit || e > 22 || e < -22)
+            invalid_static_json("number cannot be converted exactly at compile time");
+        for (x = e < 0 ? -e : e; x > 0; x--)
+            scale *= 10.0; /* exact up to 10^22 */
+        n = e < 0 ? static_cast<double>(d) / scale : static_cast<double>(d) * scale;
+        return negative ? -n : n;
+    }
+
+    constexpr void put(char ch) noexcept {
+        if (out_)
+            out_->chars[chars] = ch;
+        chars++;
+    }
+
+    constexpr unsigned hex4() {
+        unsigned u = 0;
+        for (int i = 0; i < 4; i++, p_++) {
+            char ch = peek();
+            u <<= 4;
+            if      (ch >= '0' && ch <= '9') u |= ch - '0';
+            else if (ch >= 'A' && ch <= 'F') u |= ch - ('A' - 10);
+            else if (ch >= 'a' && ch <= 'f') u |= ch - ('a' - 10);
+            else invalid_static_json("invalid unicode hex");
+        }
+        return u;
+    }
+
+    constexpr void utf8(unsigned u) noexcept {
+        if (u <= 0x7F)
+            put(static_cast<char>(u));
+        else if (u <= 0x7FF) {
+            put(static_cast<char>(0xC0 | (u >> 6)));
+            put(static_cast<char>(0x80 | (u & 0x3F)));
+        }
+        else if (u <= 0xFFFF) {
+            put(static_cast<char>(0xE0 | (u >> 12)));
+            put(static_cast<char>(0x80 | ((u >> 6) & 0x3F)));
+            put(static_cast<char>(0x80 | (u & 0x3F)));
+        }
+        else {
+            put(static_cast<char>(0xF0 | (u >> 18)));
+            put(static_cast<char>(0x80 | ((u >> 12) & 0x3F)));
+            put(static_cast<char>(0x80 | ((u >> 6) & 0x3F)));
+            put(static_cast<char>(0x80 | (u & 0x3F)));
+        }
+    }
+
+    /* Decodes a string into the character block and returns its length, without the null */
+    constexpr std::size_t string() {
+        std::size_t head = chars, len;
+        for (p_++;;) {
+            char ch = peek();
+            p_++;
+            if (ch == '"')
+                break;
+            if (ch == '\0')
+                invalid_static_json("miss quotation mark");
+            else if (ch == '\\') {
+                ch = peek();
+                p_++;
+                switch (ch) {
+                    case '"':  put('"');  break;
+                    case '\\': put('\\'); break;
+                    case '/':  put('/');  break;
+                    case 'b':  put('\b'); break;
+                    case 'f':  put('\f'); break;
+                    case 'n':  put('\n'); break;
+                    case 'r':  put('\r'); break;
+                    case 't':  put('\t'); break;
+                    case 'u': {
+                        unsigned u = hex4();
+                        if (u >= 0xD800 && u <= 0xDBFF) { /* surrogate pair */
+                            unsigned u2;
+                            if (peek() != '\\')
+                                invalid_static_json("invalid unicode surrogate");
+                            p_++;
+                            if (peek() != 'u')
+                                invalid_static_json("invalid unicode surrogate");
+                            p_++;
+                            u2 = hex4();
+                            if (u2 < 0xDC00 || u2 > 0xDFFF)
+                                invalid_static_json("invalid unicode surrogate");
+                            u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                        }
+                        utf8(u);
+                        break;
+                    }
+                    default: invalid_static_json("invalid string escape");
+                }
+            }
+            else if (static_cast<unsigned char>(ch) < 0x20)
+                invalid_static_json("invalid string char");
+            else
+                put(ch);
+        }
+        len = chars - head;
+        put('\0');
+        return len;
+    }
+
+    /* Element or member count of the container at p_, from a counting copy */
+    constexpr std::size_t count(char close) {
+        static_parser s(*this);
+        std::size_t n = 0;
+        s.out_ = nullptr;
+        s.p_++;
+        s.whitespace();
+        if (s.peek() == close)
+            return 0;
+        for (;; n++) {
+            if (close == '}') {
+                if (s.peek() != '"')
+                    invalid_static_json("miss key");
+                s.string();
+                s.whitespace();
+                if (s.peek() != ':')
+                    invalid_static_json("miss colon");
+                s.p_++;
+                s.whitespace();
+            }
+            s.value(nullptr);
+            s.whitespace();
+            if (s.peek() == close)
+                return n + 1;
+            if (s.peek() != ',')
+                invalid_static_json(close == ']' ? "miss comma or square bracket" : "miss comma or curly bracket");
+            s.p_++;
+            s.whitespace();
+        }
+    }
+
+    constexpr void array(milo_value* v) {
+        std::size_t i, n = count(']'), block = values;
+        values += n;
+        if (v) {
+            v->type = MILO_ARRAY;
+            v->u.a.e = n ? const_cast<milo_value*>(&self_->values[block]) : nullptr;
+#ifdef MILO_COMPACT
+            v->size = static_cast<unsigned>(n);
+#else
+            v->u.a.size = n;
+#endif
+        }
+        for (p_++, i = 0; i < n; i++) {
+            whitespace();
+            value(out_ ? &out_->values[block + i] : nullptr);
+            whitespace();
+            p_++; /* ',' or ']', checked by count() */
+        }
+        if (n == 0) {
+            whitespace();
+            p_++;
+        }
+    }
+
+    constexpr void object(milo_value* v) {
+        std::size_t i, n = count('}'), block = members;
+        members += n;
+        if (v) {
+            v->type = MILO_OBJECT;
+            v->u.o.m = n ? const_cast<milo_member*>(&self_->members[block]) : nullptr;
+#ifdef MILO_COMPACT
+            v->size = static_cast<unsigned>(n);
+#else
+            v->u.o.size = n;
+#endif
+        }
+        for (p_++, i = 0; i < n; i++) {
+            std::size_t head, len;
+            whitespace();
+            head = chars;
+            len = string();
+            if (out_) {
+                out_->members[block + i].k = const_cast<char*>(&self_->chars[head]);
+                out_->members[block + i].klen = len;
+            }
+            whitespace();
+            p_++; /* ':' */
+            whitespace();
+            value(out_ ? &out_->members[block + i].v : nullptr);
+            whitespace();
+            p_++; /* ',' or '}' */
+        }
+        if (n == 0) {
+            whitespace();
+            p_++;
+        }
+    }
+};
+
+struct static_counts {
+    std::size_t values, members, chars;
+};
+
+consteval static_counts static_measure(std::string_view json) {
+    static_parser<static_tables<1, 0, 0>> s(json, nullptr, nullptr);
+    s.document();
+    return static_counts{ s.values, s.members, s.chars };
+}
+
+template <class Tables>
+consteval Tables static_build(std::string_view json, const Tables* self) {
+    Tables t{};
+    static_parser<Tables> s(json, &t, self);
+    s.document();
+    return t;
+}
+
+} /* namespace detail */
+
+/* A string literal as a template argument */
+template <std::size_t N>
+struct literal {
+    char data[N];
+    constexpr literal(const char (&s)[N]) noexcept : data() {
+        for (std::size_t i = 0; i < N; i++)
+            data[i] = s[i];
+    }
+    constexpr std::string_view view() const noexcept { return std::string_view(data, N - 1); }
+};
+
+/*
+ * JSON parsed at compile time into static, read-only tables: no parse at
+ * startup and no heap.  Malformed JSON fails the build.  Numbers must be
+ * exact after one rounding, see detail::static_parser::number().
+ *
+ *     using defaults = milo::static_document<R"({"retries":3})">;
+ *     int retries = defaults::root().value(0).get<int>();
+ */
+template <literal Json>
+class static_document {
+    static constexpr detail::static_counts counts_ = detail::static_measure(Json.view());
+    using tables = detail::static_tables<counts_.values, counts_.members, counts_.chars>;
+    static constexpr tables tables_ = detail::static_build<tables>(Json.view(), &static_document::tables_);
+
+public:
+    static constexpr value_ref root() noexcept { return value_ref(&tables_.values[0]); }
+    static constexpr const milo_value* c_value() noexcept { return &tables_.values[0]; }
+};
+#endif
+
+} /* namespace milo */
+
+#endif /* MILOJSON_HPP__ */
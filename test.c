@@ -8,6 +8,11 @@
 
 #include "milo.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define TEST_THREADS
+#include <pthread.h>
+#endif
+
 static int main_ret = 0;
 static int test_count = 0;
 static int test_pass = 0;
@@ -37,6 +42,17 @@ static int test_pass = 0;
 #define EXPECT_EQ_SIZE_T(expect, actual) EXPECT_EQ_BASE((expect) == (actual), (size_t)expect, (size_t)actual, "%zu")
 #endif
 
+/* Validates a copy without a terminator so that any over-read is caught by the sanitizers */
+static int validate_exact(const char* json, size_t* err_offset) {
+    size_t len = strlen(json);
+    char* copy = (char*)malloc(len + (len == 0));
+    int ret;
+    memcpy(copy, json, len);
+    ret = milo_validate(copy, len, err_offset);
+    free(copy);
+    return ret;
+}
+
 static void test_parse_null() {
     milo_value v;
     milo_init(&v);
@@ -107,6 +123,66 @@ static void test_parse_number() {
     TEST_NUMBER(-1.7976931348623157e+308, "-1.7976931348623157e+308");
 }
 
+#define TEST_LAZY_NUMBER(expect, json)\
+    do {\
+        milo_value v;\
+        const char* lexeme;\
+        char* json2;\
+        size_t length;\
+        milo_init(&v);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, json, MILO_PARSE_OPT_LAZY_NUMBERS));\
+        EXPECT_EQ_INT(MILO_NUMBER, milo_get_type(&v));\
+        lexeme = milo_get_number_lexeme(&v, &length);\
+        EXPECT_TRUE(lexeme != NULL);\
+        if (lexeme != NULL)\
+            EXPECT_EQ_STRING(json, lexeme, length);\
+        EXPECT_EQ_DOUBLE(expect, milo_get_number(&v));\
+        EXPECT_EQ_DOUBLE(expect, milo_get_number(&v));\
+        json2 = milo_stringify(&v, &length);\
+        EXPECT_EQ_STRING(json, json2, length);\
+        free(json2);\
+        milo_free(&v);\
+    } while(0)
+
+static void test_parse_lazy_number() {
+    milo_value v;
+    size_t length;
+    char* json;
+
+    TEST_LAZY_NUMBER(0.0, "0");
+    TEST_LAZY_NUMBER(0.0, "-0");
+    TEST_LAZY_NUMBER(-1.0, "-1");
+    TEST_LAZY_NUMBER(1.0, "1.0");
+    TEST_LAZY_NUMBER(1E10, "1E10");
+    TEST_LAZY_NUMBER(-1.5e-10, "-1.50e-10");
+    TEST_LAZY_NUMBER(123456789012345.0, "123456789012345");
+    TEST_LAZY_NUMBER(9007199254740993.0, "9007199254740993");
+    TEST_LAZY_NUMBER(1.0000000000000002, "1.0000000000000002");
+    TEST_LAZY_NUMBER(1.5e300, "1.5e+300");
+    TEST_LAZY_NUMBER(4.9406564584124654e-324, "4.9406564584124654e-324");
+
+    /* numbers that may not fit a double are still converted and range-checked while parsing */
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_NUMBER_TOO_BIG, milo_parse_ex(&v, "1e309", MILO_PARSE_OPT_LAZY_NUMBERS));
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "1.7976931348623157e+308", MILO_PARSE_OPT_LAZY_NUMBERS));
+    EXPECT_TRUE(milo_get_number_lexeme(&v, &length) == NULL);
+    EXPECT_EQ_DOUBLE(1.7976931348623157e+308, milo_get_number(&v));
+    milo_free(&v);
+
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[1.50,{\"a\":2E+3}]", MILO_PARSE_OPT_LAZY_NUMBERS));
+    json = milo_stringify(&v, &length);
+    EXPECT_EQ_STRING("[1.50,{\"a\":2E+3}]", json, length);
+    free(json);
+    milo_set_number(milo_get_array_element(&v, 0), 1.25);
+    EXPECT_TRUE(milo_get_number_lexeme(milo_get_array_element(&v, 0), &length) == NULL);
+    json = milo_stringify(&v, &length);
+    EXPECT_EQ_STRING("[1.25,{\"a\":2E+3}]", json, length);
+    free(json);
+    milo_free(&v);
+}
+
 #define TEST_STRING(expect, json)\
     do {\
         milo_value v;\
@@ -128,6 +204,7 @@ static void test_parse_string() {
     TEST_STRING("\xE2\x82\xAC", "\"\\u20AC\""); /* Euro sign U+20AC */
     TEST_STRING("\xF0\x9D\x84\x9E", "\"\\uD834\\uDD1E\"");  /* G clef sign U+1D11E */
     TEST_STRING("\xF0\x9D\x84\x9E", "\"\\ud834\\udd1e\"");  /* G clef sign U+1D11E */
+    TEST_STRING("0123456789abcdef0123456789abcdef\n0123456789abcdef\"", "\"0123456789abcdef0123456789abcdef\\n0123456789abcdef\\\"\"");
 }
 
 static void test_parse_array() {
@@ -313,6 +390,42 @@ static void test_parse_invalid_unicode_surrogate() {
     TEST_ERROR(MILO_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD800\\uE000\"");
 }
 
+#define TEST_UTF8(expect, json)\
+    do {\
+        milo_value v;\
+        milo_init(&v);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, json, MILO_PARSE_OPT_VALIDATE_UTF8));\
+        EXPECT_EQ_STRING(expect, milo_get_string(&v), milo_get_string_length(&v));\
+        milo_free(&v);\
+    } while(0)
+
+#define TEST_UTF8_ERROR(json)\
+    do {\
+        milo_value v;\
+        milo_init(&v);\
+        EXPECT_EQ_INT(MILO_PARSE_INVALID_UTF8, milo_parse_ex(&v, json, MILO_PARSE_OPT_VALIDATE_UTF8));\
+        EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, json));\
+        milo_free(&v);\
+    } while(0)
+
+static void test_parse_utf8() {
+    TEST_UTF8("Hello", "\"Hello\"");
+    TEST_UTF8("\xC2\xA2\xE2\x82\xAC\xF0\x9D\x84\x9E", "\"\xC2\xA2\xE2\x82\xAC\xF0\x9D\x84\x9E" "\"");
+    TEST_UTF8("0123456789abcdef0123456789abcdef\xE2\x82\xAC" "0123456789abcdef\\",
+        "\"0123456789abcdef0123456789abcdef\xE2\x82\xAC" "0123456789abcdef\\\\\"");
+    TEST_UTF8("\xED\x9F\xBF\xEE\x80\x80\xF4\x8F\xBF\xBF", "\"\xED\x9F\xBF\xEE\x80\x80\xF4\x8F\xBF\xBF" "\""); /* U+D7FF U+E000 U+10FFFF */
+    TEST_UTF8_ERROR("\"\x80\"");             /* lone continuation byte */
+    TEST_UTF8_ERROR("\"\xC0\x80\"");         /* overlong NUL */
+    TEST_UTF8_ERROR("\"\xE0\x9F\xBF\"");     /* overlong U+07FF */
+    TEST_UTF8_ERROR("\"\xED\xA0\x80\"");     /* surrogate U+D800 */
+    TEST_UTF8_ERROR("\"\xF4\x90\x80\x80\""); /* beyond U+10FFFF */
+    TEST_UTF8_ERROR("\"\xF5\x80\x80\x80\"");
+    TEST_UTF8_ERROR("\"\xE2\x82\"");         /* truncated sequence */
+    TEST_UTF8_ERROR("\"0123456789abcdef0123456789abcdef\xFF\"");
+    TEST_UTF8_ERROR("{\"\xFF" "\":1}");          /* keys are validated too */
+}
+
 static void test_parse_miss_comma_or_square_bracket() {
     TEST_ERROR(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1");
     TEST_ERROR(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1}");
@@ -343,11 +456,514 @@ static void test_parse_miss_comma_or_curly_bracket() {
     TEST_ERROR(MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
 }
 
+#define TEST_PROJECTED(expect, json, paths)\
+    do {\
+        milo_value v;\
+        char* json2;\
+        size_t length;\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_projected(&v, json, paths, sizeof(paths) / sizeof(paths[0]), 0));\
+        json2 = milo_stringify(&v, &length);\
+        EXPECT_EQ_STRING(expect, json2, length);\
+        milo_free(&v);\
+        free(json2);\
+    } while(0)
+
+#define TEST_PROJECTED_ERROR(error, json, paths)\
+    do {\
+        milo_value v;\
+        v.type = MILO_FALSE;\
+        EXPECT_EQ_INT(error, milo_parse_projected(&v, json, paths, sizeof(paths) / sizeof(paths[0]), 0));\
+        EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));\
+    } while(0)
+
+static void test_parse_projected() {
+    static const char* const id[] = { "/id" };
+    static const char* const names[] = { "/items/*/name", "/id" };
+    static const char* const second[] = { "/items/1" };
+    static const char* const all[] = { "" };
+    static const char* const escaped[] = { "/a~1b/~0" };
+    static const char* const deep[] = { "/a/b/c" };
+    static const char* const many[] = {
+        "/k/0", "/k/a", "/k/b", "/k/c", "/k/d", "/k/e", "/k/f", "/k/g", "/k/h",
+        "/k/i", "/k/j", "/k/k", "/k/l", "/k/m", "/k/n", "/k/-", "/k/16"
+    };
+    const char* doc =
+        "{ \"id\" : 7, \"skip\" : [ { \"x\" : \"\\u00e9\\uD834\\uDD1E\" }, -1.5e10, true, null ], "
+        "\"items\" : [ { \"name\" : \"a\", \"n\" : 1 }, { \"n\" : 2 }, { \"name\" : \"c\" } ] }";
+
+    TEST_PROJECTED("{\"id\":7}", doc, id);
+    TEST_PROJECTED("{\"id\":7,\"items\":[{\"name\":\"a\"},{},{\"name\":\"c\"}]}", doc, names);
+    TEST_PROJECTED("{\"items\":[{\"n\":2}]}", doc, second);
+    TEST_PROJECTED("{\"a/b\":{\"~\":1}}", "{\"a/b\":{\"~\":1,\"x\":2},\"ab\":3}", escaped);
+    TEST_PROJECTED("{\"a\":{}}", "{\"a\":{\"b\":1}}", deep);
+    TEST_PROJECTED("[1,2]", "[1,2]", all);
+    TEST_PROJECTED("[]", "[1,2]", id);
+    TEST_PROJECTED("null", "1", id);
+    TEST_PROJECTED("{\"k\":[0,16]}", "{\"k\":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16]}", many);
+
+    /* Keys with escapes are decoded for matching and when kept */
+    TEST_PROJECTED("{\"id\":1}", "{\"\\u0069d\":1,\"i\\\"d\":2}", id);
+    TEST_PROJECTED("{\"a/b\":{\"~\":1}}", "{\"a\\/b\":{\"\\u007e\":1,\"\\u00e9\":2},\"x\\n\":3}", escaped);
+    TEST_PROJECTED("{\"k\":{\"0\":5,\"n\":null}}", "{\"k\":{\"e\\n\":[],\"\\u0030\":5,\"n\":null}}", many);
+    TEST_PROJECTED_ERROR(MILO_PARSE_INVALID_STRING_ESCAPE, "{\"\\x\":1}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_COLON, "{\"id\" 1}", id);
+
+    /* Skipped values are still validated */
+    TEST_PROJECTED_ERROR(MILO_PARSE_INVALID_VALUE, "{\"id\":1,\"x\":[tru]}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_INVALID_VALUE, "{\"x\":-,\"id\":1}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_INVALID_STRING_ESCAPE, "{\"x\":\"\\v\",\"id\":1}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_INVALID_UNICODE_SURROGATE, "{\"x\":\"\\uD800\"}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_QUOTATION_MARK, "{\"x\":\"abc", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "{\"x\":[1 2]}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"x\":{\"a\":1 \"b\":2}}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"id\":1 \"x\":2}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "{\"items\":[{},{} {}]}", second);
+    TEST_PROJECTED_ERROR(MILO_PARSE_INVALID_VALUE, "{\"items\":[{},{},]}", second);
+    TEST_PROJECTED_ERROR(MILO_PARSE_MISS_KEY, "{\"id\":1,}", id);
+    TEST_PROJECTED_ERROR(MILO_PARSE_ROOT_NOT_SINGULAR, "{\"id\":1} 2", id);
+}
+
+static void test_parse_next() {
+    const char* json = "{\"a\":1} [1,2]\n\"s\"\x1E" "true\n\x1E" "12 null[] ";
+    milo_iter it;
+    milo_value v;
+    char* json2;
+    size_t length;
+
+    milo_iter_init(&it, json, 0);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_OBJECT, milo_get_type(&v));
+    EXPECT_EQ_SIZE_T(7, it.offset);
+    milo_free(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    json2 = milo_stringify(&v, &length);
+    EXPECT_EQ_STRING("[1,2]", json2, length);
+    EXPECT_EQ_SIZE_T(13, it.offset);
+    free(json2);
+    milo_free(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_STRING("s", milo_get_string(&v), milo_get_string_length(&v));
+    milo_free(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_TRUE, milo_get_type(&v));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_DOUBLE(12.0, milo_get_number(&v));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_SIZE_T(0, milo_get_array_size(&v));
+    milo_free(&v);
+    EXPECT_EQ_INT(MILO_PARSE_END, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    EXPECT_EQ_INT(MILO_PARSE_END, milo_parse_next(&it, &v));
+    milo_iter_free(&it);
+
+    milo_iter_init(&it, "1 [2,", 0);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_PARSE_EXPECT_VALUE, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    EXPECT_EQ_SIZE_T(2, it.offset);
+    milo_iter_free(&it);
+
+    milo_iter_init(&it, " \x1E\n", 0);
+    EXPECT_EQ_INT(MILO_PARSE_END, milo_parse_next(&it, &v));
+    milo_iter_free(&it);
+}
+
+#define TEST_RECYCLE(v, json)\
+    do {\
+        char* json2;\
+        size_t length;\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(v, json, MILO_PARSE_OPT_RECYCLE));\
+        json2 = milo_stringify(v, &length);\
+        EXPECT_EQ_STRING(json, json2, length);\
+        free(json2);\
+    } while(0)
+
+static void test_parse_recycle() {
+    milo_value v;
+    milo_iter it;
+    milo_init(&v);
+    TEST_RECYCLE(&v, "{\"id\":1,\"name\":\"abc\",\"tags\":[\"x\",\"y\"]}");
+    TEST_RECYCLE(&v, "{\"id\":2,\"name\":\"ab\",\"tags\":[\"x\",\"y\",\"z\"]}");
+    TEST_RECYCLE(&v, "{\"id\":3,\"name\":null,\"tags\":[]}");
+    TEST_RECYCLE(&v, "{\"id\":\"4\",\"other\":{\"a\":[1,{\"b\":true}]},\"tags\":[[1],\"z\"],\"x\":false}");
+    TEST_RECYCLE(&v, "{\"id\":5}");
+    TEST_RECYCLE(&v, "[{\"id\":5},\"s\",[]]");
+    TEST_RECYCLE(&v, "[{\"id\":6,\"k\":\"longer key value\"},[\"t\"],{}]");
+    TEST_RECYCLE(&v, "\"text\"");
+    TEST_RECYCLE(&v, "\"longer text than before\"");
+    TEST_RECYCLE(&v, "1.5");
+    TEST_RECYCLE(&v, "{\"a\":[1,2,3]}");
+
+    /* On error the old tree is released and the value is null */
+    EXPECT_EQ_INT(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, milo_parse_ex(&v, "{\"a\":[\"1\" 2]}", MILO_PARSE_OPT_RECYCLE));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    TEST_RECYCLE(&v, "{\"a\":[1,2,3],\"b\":{\"c\":\"d\"}}");
+    EXPECT_EQ_INT(MILO_PARSE_MISS_COLON, milo_parse_ex(&v, "{\"a\":[1],\"b\"}", MILO_PARSE_OPT_RECYCLE));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    TEST_RECYCLE(&v, "{\"a\":\"x\",\"b\":[1]}");
+    EXPECT_EQ_INT(MILO_PARSE_INVALID_STRING_ESCAPE, milo_parse_ex(&v, "{\"a\":\"\\x\"}", MILO_PARSE_OPT_RECYCLE));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    TEST_RECYCLE(&v, "[1,2]");
+    EXPECT_EQ_INT(MILO_PARSE_ROOT_NOT_SINGULAR, milo_parse_ex(&v, "[1,2] 3", MILO_PARSE_OPT_RECYCLE));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+
+    milo_iter_init(&it, "{\"a\":[1]} {\"a\":[1,2]} {\"a\":[]}", MILO_PARSE_OPT_RECYCLE);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_SIZE_T(2, milo_get_array_size(milo_get_object_value(&v, 0)));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_next(&it, &v));
+    EXPECT_EQ_SIZE_T(0, milo_get_array_size(milo_get_object_value(&v, 0)));
+    EXPECT_EQ_INT(MILO_PARSE_END, milo_parse_next(&it, &v));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    milo_iter_free(&it);
+    milo_free(&v);
+}
+
+#define TEST_VALIDATE(error, offset, json)\
+    do {\
+        size_t err_offset = 12345;\
+        EXPECT_EQ_INT(error, validate_exact(json, &err_offset));\
+        EXPECT_EQ_SIZE_T(offset, err_offset);\
+    } while(0)
+
+/* Every input of TEST_NUMBER, TEST_ERROR and TEST_UTF8_ERROR, validated on its own */
+static const struct {
+    int error;
+    const char* json;
+} validate_cases[] = {
+    { MILO_PARSE_OK, "0" },
+    { MILO_PARSE_OK, "-0" },
+    { MILO_PARSE_OK, "-0.0" },
+    { MILO_PARSE_OK, "1" },
+    { MILO_PARSE_OK, "-1" },
+    { MILO_PARSE_OK, "1.5" },
+    { MILO_PARSE_OK, "-1.5" },
+    { MILO_PARSE_OK, "3.1416" },
+    { MILO_PARSE_OK, "1E10" },
+    { MILO_PARSE_OK, "1e10" },
+    { MILO_PARSE_OK, "1E+10" },
+    { MILO_PARSE_OK, "1E-10" },
+    { MILO_PARSE_OK, "-1E10" },
+    { MILO_PARSE_OK, "-1e10" },
+    { MILO_PARSE_OK, "-1E+10" },
+    { MILO_PARSE_OK, "-1E-10" },
+    { MILO_PARSE_OK, "1.234E+10" },
+    { MILO_PARSE_OK, "1.234E-10" },
+    { MILO_PARSE_OK, "1e-10000" },
+    { MILO_PARSE_OK, "1.0000000000000002" },
+    { MILO_PARSE_OK, "4.9406564584124654e-324" },
+    { MILO_PARSE_OK, "-4.9406564584124654e-324" },
+    { MILO_PARSE_OK, "2.2250738585072009e-308" },
+    { MILO_PARSE_OK, "-2.2250738585072009e-308" },
+    { MILO_PARSE_OK, "2.2250738585072014e-308" },
+    { MILO_PARSE_OK, "-2.2250738585072014e-308" },
+    { MILO_PARSE_OK, "1.7976931348623157e+308" },
+    { MILO_PARSE_OK, "-1.7976931348623157e+308" },
+    { MILO_PARSE_EXPECT_VALUE, "" },
+    { MILO_PARSE_EXPECT_VALUE, " " },
+    { MILO_PARSE_INVALID_VALUE, "nul" },
+    { MILO_PARSE_INVALID_VALUE, "?" },
+    { MILO_PARSE_INVALID_VALUE, "+0" },
+    { MILO_PARSE_INVALID_VALUE, "+1" },
+    { MILO_PARSE_INVALID_VALUE, ".123" },
+    { MILO_PARSE_INVALID_VALUE, "1." },
+    { MILO_PARSE_INVALID_VALUE, "INF" },
+    { MILO_PARSE_INVALID_VALUE, "inf" },
+    { MILO_PARSE_INVALID_VALUE, "NAN" },
+    { MILO_PARSE_INVALID_VALUE, "nan" },
+    { MILO_PARSE_ROOT_NOT_SINGULAR, "null x" },
+    { MILO_PARSE_ROOT_NOT_SINGULAR, "0123" },
+    { MILO_PARSE_ROOT_NOT_SINGULAR, "0x0" },
+    { MILO_PARSE_ROOT_NOT_SINGULAR, "0x123" },
+    { MILO_PARSE_NUMBER_TOO_BIG, "1e309" },
+    { MILO_PARSE_NUMBER_TOO_BIG, "-1e309" },
+    { MILO_PARSE_MISS_QUOTATION_MARK, "\"" },
+    { MILO_PARSE_MISS_QUOTATION_MARK, "\"abc" },
+    { MILO_PARSE_INVALID_STRING_ESCAPE, "\"\\v\"" },
+    { MILO_PARSE_INVALID_STRING_ESCAPE, "\"\\'\"" },
+    { MILO_PARSE_INVALID_STRING_ESCAPE, "\"\\0\"" },
+    { MILO_PARSE_INVALID_STRING_ESCAPE, "\"\\x12\"" },
+    { MILO_PARSE_INVALID_STRING_CHAR, "\"\x01\"" },
+    { MILO_PARSE_INVALID_STRING_CHAR, "\"\x1F\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u0\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u01\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u012\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u/000\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\uG000\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u0/00\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u0G00\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u0/00\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u00G0\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u000/\"" },
+    { MILO_PARSE_INVALID_UNICODE_HEX, "\"\\u000G\"" },
+    { MILO_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD800\"" },
+    { MILO_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uDBFF\"" },
+    { MILO_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD800\\\\\"" },
+    { MILO_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD800\\uDBFF\"" },
+    { MILO_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD800\\uE000\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\x80\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\xC0\x80\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\xE0\x9F\xBF\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\xED\xA0\x80\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\xF4\x90\x80\x80\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\xF5\x80\x80\x80\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"\xE2\x82\"" },
+    { MILO_PARSE_INVALID_UTF8, "\"0123456789abcdef0123456789abcdef\xFF\"" },
+    { MILO_PARSE_INVALID_UTF8, "{\"\xFF" "\":1}" },
+    { MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1" },
+    { MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1}" },
+    { MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1 2" },
+    { MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[[]" },
+    { MILO_PARSE_MISS_KEY, "{:1," },
+    { MILO_PARSE_MISS_KEY, "{1:1," },
+    { MILO_PARSE_MISS_KEY, "{true:1," },
+    { MILO_PARSE_MISS_KEY, "{false:1," },
+    { MILO_PARSE_MISS_KEY, "{null:1," },
+    { MILO_PARSE_MISS_KEY, "{[]:1," },
+    { MILO_PARSE_MISS_KEY, "{{}:1," },
+    { MILO_PARSE_MISS_KEY, "{\"a\":1," },
+    { MILO_PARSE_MISS_COLON, "{\"a\"}" },
+    { MILO_PARSE_MISS_COLON, "{\"a\",\"b\"}" },
+    { MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1" },
+    { MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1]" },
+    { MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1 \"b\"" },
+    { MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}" },
+    { MILO_PARSE_NUMBER_TOO_BIG, "1.797693134862315807937289714053034150799341327100378269361737789804449682927647509466490179775872070963302864166928879109465555478519404026306574886715058206819089020007083836762738548458177115317644757302700698555713669596228429148198608349364752927190741684443655107043427115596995080930428801779041744977920e308" },
+    { MILO_PARSE_NUMBER_TOO_BIG, "17976931348623158079.4e289" },
+    { MILO_PARSE_NUMBER_TOO_BIG, "0.0000179769313486231581e314" },
+    { MILO_PARSE_NUMBER_TOO_BIG, "1e1000000000000000000000" },
+    { MILO_PARSE_OK, "1.797693134862315807937289714053034150799341327100378269361737789804449682927647509466490179775872070963302864166928879109465555478519404026306574886715058206819089020007083836762738548458177115317644757302700698555713669596228429148198608349364752927190741684443655107043427115596995080930428801779041744977919999e308" },
+    { MILO_PARSE_OK, "17976931348623158079e289" },
+    { MILO_PARSE_OK, "100000000000000000000e288" },
+    { MILO_PARSE_OK, "1e-1000000000000000000000" }
+};
+
+static void test_parse_validate() {
+    char buffer[64], text[148];
+    milo_value v;
+    size_t i, err_offset;
+    TEST_VALIDATE(MILO_PARSE_OK, 71, " {\"a\" : [1, -2.5e-3, true, false, null, \"\\u00e9\\uD834\\uDD1E\"], \"b\":{}} ");
+    TEST_VALIDATE(MILO_PARSE_OK, 39, "\"0123456789abcdef0123456789abcdef\xE2\x82\xAC\\n\"");
+    TEST_VALIDATE(MILO_PARSE_EXPECT_VALUE, 0, "");
+    TEST_VALIDATE(MILO_PARSE_EXPECT_VALUE, 5, "[1,2,");
+    TEST_VALIDATE(MILO_PARSE_INVALID_VALUE, 7, "[true, nul]");
+    TEST_VALIDATE(MILO_PARSE_INVALID_VALUE, 1, "[-]");
+    TEST_VALIDATE(MILO_PARSE_INVALID_VALUE, 0, "1e");
+    TEST_VALIDATE(MILO_PARSE_ROOT_NOT_SINGULAR, 5, "null x");
+    TEST_VALIDATE(MILO_PARSE_MISS_QUOTATION_MARK, 4, "\"abc");
+    TEST_VALIDATE(MILO_PARSE_INVALID_STRING_ESCAPE, 3, "\"ab\\x\"");
+    TEST_VALIDATE(MILO_PARSE_INVALID_STRING_CHAR, 2, "\"a\x01\"");
+    TEST_VALIDATE(MILO_PARSE_INVALID_UNICODE_HEX, 1, "\"\\u12");
+    TEST_VALIDATE(MILO_PARSE_INVALID_UNICODE_HEX, 1, "\"\\uD800\\u12");
+    TEST_VALIDATE(MILO_PARSE_INVALID_UNICODE_SURROGATE, 1, "\"\\uD800\\n\"");
+    TEST_VALIDATE(MILO_PARSE_INVALID_UNICODE_SURROGATE, 1, "\"\\uD800");
+    TEST_VALIDATE(MILO_PARSE_INVALID_UTF8, 3, "\"ab\xE2\x82");
+    TEST_VALIDATE(MILO_PARSE_INVALID_UTF8, 33, "\"0123456789abcdef0123456789abcdef\xC0\x80\"");
+    TEST_VALIDATE(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, 3, "[1 2]");
+    TEST_VALIDATE(MILO_PARSE_MISS_KEY, 8, "{\"a\":1, 2}");
+    TEST_VALIDATE(MILO_PARSE_MISS_COLON, 4, "{\"a\"}");
+    TEST_VALIDATE(MILO_PARSE_MISS_COMMA_OR_CURLY_BRACKET, 6, "{\"a\":1");
+
+    /* Numbers right at the overflow threshold 2^1024 - 2^970 */
+    TEST_ERROR(MILO_PARSE_NUMBER_TOO_BIG, "1.797693134862315807937289714053034150799341327100378269361737789804449682927647509466490179775872070963302864166928879109465555478519404026306574886715058206819089020007083836762738548458177115317644757302700698555713669596228429148198608349364752927190741684443655107043427115596995080930428801779041744977920e308");
+    TEST_ERROR(MILO_PARSE_NUMBER_TOO_BIG, "17976931348623158079.4e289");
+    TEST_ERROR(MILO_PARSE_NUMBER_TOO_BIG, "0.0000179769313486231581e314");
+    TEST_ERROR(MILO_PARSE_NUMBER_TOO_BIG, "1e1000000000000000000000");
+    TEST_NUMBER(1.7976931348623157e308, "1.797693134862315807937289714053034150799341327100378269361737789804449682927647509466490179775872070963302864166928879109465555478519404026306574886715058206819089020007083836762738548458177115317644757302700698555713669596228429148198608349364752927190741684443655107043427115596995080930428801779041744977919999e308");
+    TEST_NUMBER(1.7976931348623157e308, "17976931348623158079e289");
+    TEST_NUMBER(1e308, "100000000000000000000e288");
+    TEST_NUMBER(0.0, "1e-1000000000000000000000");
+
+    /* The length bounds the input, not a terminator */
+    memcpy(buffer, "[1,2]xyz", 8);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_validate(buffer, 5, NULL));
+    EXPECT_EQ_INT(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, milo_validate(buffer, 4, NULL));
+    memcpy(buffer, "[1]\0", 4);
+    EXPECT_EQ_INT(MILO_PARSE_ROOT_NOT_SINGULAR, milo_validate(buffer, 4, NULL));
+
+    for (i = 0; i < sizeof(validate_cases) / sizeof(validate_cases[0]); i++)
+        EXPECT_EQ_INT(validate_cases[i].error, validate_exact(validate_cases[i].json, NULL));
+
+    /* Long multi-byte runs report the same offset as short ones */
+    milo_init(&v);
+    for (i = 0; i <= 48; i++) {
+        size_t k;
+        text[0] = '\"';
+        for (k = 0; k < 48; k++)
+            memcpy(text + 1 + 3 * k, k == i ? "\xED\xA0\x80" : "\xE4\xB8\xAD", 3); /* U+D800 or U+4E2D */
+        memcpy(text + 145, "\"", 2);
+        EXPECT_EQ_INT(i < 48 ? MILO_PARSE_INVALID_UTF8 : MILO_PARSE_OK, milo_validate(text, 146, &err_offset));
+        EXPECT_EQ_SIZE_T(i < 48 ? 1 + 3 * i : 146, err_offset);
+        EXPECT_EQ_INT(i < 48 ? MILO_PARSE_INVALID_UTF8 : MILO_PARSE_OK, milo_parse_ex(&v, text, MILO_PARSE_OPT_VALIDATE_UTF8));
+        if (i < 48) {
+            text[2 + 3 * i] = (char)0xB8;
+            text[1 + 3 * i + i % 3] = (char)0xFF;
+            EXPECT_EQ_INT(MILO_PARSE_INVALID_UTF8, milo_validate(text, 146, &err_offset));
+            EXPECT_EQ_SIZE_T(1 + 3 * i, err_offset);
+            EXPECT_EQ_INT(MILO_PARSE_INVALID_UTF8, milo_parse_ex(&v, text, MILO_PARSE_OPT_VALIDATE_UTF8));
+            memcpy(text + 1 + 3 * i, "\xE4\xB8\"", 3); /* truncated right before the closing quote */
+            EXPECT_EQ_INT(MILO_PARSE_INVALID_UTF8, milo_validate(text, 4 + 3 * i, &err_offset));
+            EXPECT_EQ_SIZE_T(1 + 3 * i, err_offset);
+            EXPECT_EQ_INT(MILO_PARSE_INVALID_UTF8, milo_parse_ex(&v, text, MILO_PARSE_OPT_VALIDATE_UTF8));
+        }
+    }
+    milo_free(&v);
+}
+
+#define TEST_PACKED(json)\
+    do {\
+        milo_value v;\
+        char* json2;\
+        size_t length;\
+        milo_init(&v);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, json, MILO_PARSE_OPT_PACK_NUMBERS));\
+        json2 = milo_stringify(&v, &length);\
+        EXPECT_EQ_STRING(json, json2, length);\
+        EXPECT_EQ_SIZE_T(length, milo_stringify_size(&v));\
+        milo_free(&v);\
+        free(json2);\
+    } while(0)
+
+static void test_parse_packed() {
+    milo_value v, w;
+    const double* n;
+    size_t count, length;
+    char* bin;
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_NUMBER_TOO_BIG, milo_parse_ex(&v, "[1,1E400]", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[ 1 , -2.5e1 ,0.125, 123456789012345678 ]", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_TRUE(milo_get_number_array(&v, &n, &count));
+    EXPECT_EQ_SIZE_T(4, count);
+    EXPECT_EQ_DOUBLE(1.0, n[0]);
+    EXPECT_EQ_DOUBLE(-25.0, n[1]);
+    EXPECT_EQ_DOUBLE(0.125, n[2]);
+    EXPECT_EQ_DOUBLE(123456789012345678.0, n[3]);
+    EXPECT_EQ_SIZE_T(4, milo_get_array_size(&v));
+
+    /* Encodings read packed arrays directly */
+    bin = milo_encode_binary(&v, &length);
+    milo_init(&w);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_decode_binary(&w, bin, length));
+    EXPECT_FALSE(milo_get_number_array(&w, &n, &count));
+    EXPECT_EQ_DOUBLE(-25.0, milo_get_number(milo_get_array_element(&w, 1)));
+    milo_free(&w);
+    free(bin);
+
+    /* Reads never unpack, so the block stays valid */
+    EXPECT_TRUE(milo_get_number_array(&v, &n, &count));
+    free(milo_stringify(&v, &length));
+    EXPECT_TRUE(milo_equal(&v, &v, 0));
+    milo_hash(&v);
+    EXPECT_TRUE(milo_get_number_array(&v, &n, &count));
+    EXPECT_EQ_DOUBLE(0.125, n[2]);
+
+    /* Unpacking is explicit and invalidates the block */
+    milo_unpack_array(&v);
+    EXPECT_FALSE(milo_get_number_array(&v, &n, &count));
+    EXPECT_EQ_DOUBLE(0.125, milo_get_number(milo_get_array_element(&v, 2)));
+    EXPECT_EQ_DOUBLE(1.0, milo_get_number(milo_get_array_element(&v, 0)));
+    milo_unpack_array(&v);
+    EXPECT_EQ_SIZE_T(4, milo_get_array_size(&v));
+    milo_free(&v);
+
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[1,\"a\",2]", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_FALSE(milo_get_number_array(&v, &n, &count));
+    EXPECT_EQ_SIZE_T(3, milo_get_array_size(&v));
+    EXPECT_EQ_DOUBLE(1.0, milo_get_number(milo_get_array_element(&v, 0)));
+    EXPECT_EQ_DOUBLE(2.0, milo_get_number(milo_get_array_element(&v, 2)));
+    milo_free(&v);
+
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "{\"a\":[[1,2],[]]}", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_FALSE(milo_get_number_array(milo_get_object_value(&v, 0), &n, &count));
+    EXPECT_TRUE(milo_get_number_array(milo_get_array_element(milo_get_object_value(&v, 0), 0), &n, &count));
+    EXPECT_FALSE(milo_get_number_array(milo_get_array_element(milo_get_object_value(&v, 0), 1), &n, &count));
+    milo_free(&v);
+
+    EXPECT_EQ_INT(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, milo_parse_ex(&v, "[1,2", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_EQ_INT(MILO_PARSE_INVALID_VALUE, milo_parse_ex(&v, "[1,2,]", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_EQ_INT(MILO_PARSE_INVALID_VALUE, milo_parse_ex(&v, "[1,-]", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_EQ_INT(MILO_PARSE_INVALID_VALUE, milo_parse_ex(&v, "[1,2,nul]", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+
+    TEST_PACKED("[0,-0,1,-1,1.5,0.25,-12345,999999999999999,1000000000000000,1e+22]");
+    TEST_PACKED("[[1,2,3],{\"x\":[4,null]},[]]");
+
+    /* Recycling reuses packed blocks and regular ones alike */
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[1,2,3]", MILO_PARSE_OPT_PACK_NUMBERS | MILO_PARSE_OPT_RECYCLE));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[true,2]", MILO_PARSE_OPT_PACK_NUMBERS | MILO_PARSE_OPT_RECYCLE));
+    EXPECT_FALSE(milo_get_number_array(&v, &n, &count));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[4,5]", MILO_PARSE_OPT_PACK_NUMBERS | MILO_PARSE_OPT_RECYCLE));
+    EXPECT_TRUE(milo_get_number_array(&v, &n, &count));
+    EXPECT_EQ_DOUBLE(5.0, n[1]);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[6,[7]]", MILO_PARSE_OPT_PACK_NUMBERS | MILO_PARSE_OPT_RECYCLE));
+    EXPECT_EQ_SIZE_T(2, milo_get_array_size(&v));
+    milo_free(&v);
+}
+
+#ifdef MILO_COMPACT_SIZE_MAX
+/* open item,item,...,item close with n items; an empty sep gives one run of n items */
+static char* test_repeat(const char* open, const char* item, const char* sep, size_t n, const char* close) {
+    size_t i, len = strlen(item) + strlen(sep);
+    char* json = (char*)malloc(strlen(open) + n * len + strlen(close) + 1), *p = json;
+    p += strlen(strcpy(p, open));
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            p += strlen(strcpy(p, sep));
+        p += strlen(strcpy(p, item));
+    }
+    strcpy(p, close);
+    return json;
+}
+
+#define TEST_SIZE_LIMIT(open, item, sep, close, flags)\
+    do {\
+        milo_value v;\
+        char* json;\
+        milo_init(&v);\
+        json = test_repeat(open, item, sep, MILO_COMPACT_SIZE_MAX, close);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, json, flags));\
+        if (!((flags) & MILO_PARSE_OPT_RECYCLE))\
+            milo_free(&v);\
+        free(json);\
+        json = test_repeat(open, item, sep, MILO_COMPACT_SIZE_MAX + 1UL, close);\
+        EXPECT_EQ_INT(MILO_PARSE_SIZE_TOO_BIG, milo_parse_ex(&v, json, flags));\
+        EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));\
+        free(json);\
+        milo_free(&v);\
+    } while(0)
+
+static void test_parse_size_limit() {
+    const char* all = "/*";
+    milo_value v;
+    char* json;
+    TEST_SIZE_LIMIT("\"", "a", "", "\"", 0);
+    TEST_SIZE_LIMIT("[", "null", ",", "]", 0);
+    TEST_SIZE_LIMIT("[", "1", ",", "]", MILO_PARSE_OPT_PACK_NUMBERS);
+    TEST_SIZE_LIMIT("{", "\"k\":0", ",", "}", 0);
+    TEST_SIZE_LIMIT("[", "[1]", ",", "]", MILO_PARSE_OPT_RECYCLE);
+
+    milo_init(&v);
+    json = test_repeat("[", "0", ",", MILO_COMPACT_SIZE_MAX + 1UL, "]");
+    EXPECT_EQ_INT(MILO_PARSE_SIZE_TOO_BIG, milo_parse_projected(&v, json, &all, 1, 0));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    free(json);
+    json = test_repeat("{", "\"k\":0", ",", MILO_COMPACT_SIZE_MAX + 1UL, "}");
+    EXPECT_EQ_INT(MILO_PARSE_SIZE_TOO_BIG, milo_parse_projected(&v, json, &all, 1, 0));
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    free(json);
+}
+#endif
+
 static void test_parse() {
     test_parse_null();
     test_parse_true();
     test_parse_false();
     test_parse_number();
+    test_parse_lazy_number();
     test_parse_string();
     test_parse_array();
     test_parse_object();
@@ -361,10 +977,19 @@ static void test_parse() {
     test_parse_invalid_string_char();
     test_parse_invalid_unicode_hex();
     test_parse_invalid_unicode_surrogate();
+    test_parse_utf8();
     test_parse_miss_comma_or_square_bracket();
     test_parse_miss_key();
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
+    test_parse_validate();
+    test_parse_projected();
+    test_parse_next();
+    test_parse_recycle();
+    test_parse_packed();
+#ifdef MILO_COMPACT_SIZE_MAX
+    test_parse_size_limit();
+#endif
 }
 
 
@@ -410,6 +1035,9 @@ static void test_stringify_string() {
     TEST_ROUNDTRIP("\"Hello\\nWorld\"");
     TEST_ROUNDTRIP("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
     TEST_ROUNDTRIP("\"Hello\\u0000World\"");
+    TEST_ROUNDTRIP("\"0123456789abcdef0123456789abcdef\"");
+    TEST_ROUNDTRIP("\"0123456789abcde\\\"0123456789abcdef\\u001F0123456789abcdef\\n\"");
+    TEST_ROUNDTRIP("\"\\t0123456789abcdef\\u0001\\\\\\r\"");
 }
 
 static void test_stringify_array() {
@@ -422,6 +1050,205 @@ static void test_stringify_object() {
     TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
 }
 
+#define TEST_STRINGIFY_TO(json)\
+    do {\
+        milo_value v;\
+        char buffer[sizeof(json) + 1];\
+        milo_init(&v);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, json));\
+        EXPECT_EQ_SIZE_T(sizeof(json) - 1, milo_stringify_size(&v));\
+        memset(buffer, '#', sizeof(buffer));\
+        EXPECT_EQ_SIZE_T(sizeof(json) - 1, milo_stringify_to(&v, buffer, sizeof(json) - 1));\
+        EXPECT_EQ_STRING(json, buffer, sizeof(json) - 1);\
+        EXPECT_TRUE(buffer[sizeof(json) - 1] == '#');\
+        memset(buffer, '#', sizeof(buffer));\
+        EXPECT_EQ_SIZE_T(sizeof(json) - 1, milo_stringify_to(&v, buffer, sizeof(json) / 2));\
+        EXPECT_TRUE(buffer[sizeof(json) / 2] == '#');\
+        milo_free(&v);\
+    } while(0)
+
+static void test_stringify_to() {
+    TEST_STRINGIFY_TO("null");
+    TEST_STRINGIFY_TO("-1.5");
+    TEST_STRINGIFY_TO("\"Hello\\u0000World\\n\"");
+    TEST_STRINGIFY_TO("[null,false,true,123,\"abc\",[1,2,3]]");
+    TEST_STRINGIFY_TO("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+}
+
+#ifdef MILO_HAS_IOV
+static void test_stringify_iov_max(const milo_value* v, size_t max, size_t expect_count, size_t expect_refs) {
+    struct iovec iov[8];
+    char* json, *scratch, *joined;
+    size_t length, count, i, refs = 0, total = 0;
+    json = milo_stringify(v, &length);
+    count = milo_stringify_iov(v, iov, max, &scratch);
+    EXPECT_EQ_SIZE_T(expect_count, count);
+    joined = (char*)malloc(length);
+    for (i = 0; i < count; i++) {
+        if (total + iov[i].iov_len <= length)
+            memcpy(joined + total, iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+        if ((char*)iov[i].iov_base < scratch || (char*)iov[i].iov_base >= scratch + length)
+            refs++;
+    }
+    EXPECT_EQ_SIZE_T(length, total);
+    EXPECT_EQ_SIZE_T(expect_refs, refs);
+    EXPECT_TRUE(total == length && memcmp(json, joined, length) == 0);
+    free(joined);
+    free(scratch);
+    free(json);
+}
+
+static void test_stringify_iov() {
+    milo_value v, *e;
+    char big[1000];
+    memset(big, 'x', sizeof(big));
+    big[600] = '\n';
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "[1,\"short\",null,{\"k\":null}]"));
+    milo_set_string(milo_get_array_element(&v, 2), big, sizeof(big));
+    milo_set_string(milo_get_object_value(milo_get_array_element(&v, 3), 0), big, 300);
+    test_stringify_iov_max(&v, 8, 7, 3);   /* scratch, x*600, scratch, x*399, scratch, x*300, scratch */
+    test_stringify_iov_max(&v, 4, 3, 1);   /* only the first run is referenced */
+    test_stringify_iov_max(&v, 1, 1, 0);   /* everything copied */
+    e = milo_get_array_element(&v, 2);
+    milo_set_string(e, big, 100);
+    test_stringify_iov_max(e, 8, 1, 0);
+    milo_free(&v);
+}
+#endif
+
+#ifdef MILO_STRINGIFY_CACHE
+#define EXPECT_CACHED_EQ_STRINGIFY(v, cache)\
+    do {\
+        char* json;\
+        const char* cached;\
+        size_t length, clength;\
+        json = milo_stringify(v, &length);\
+        cached = milo_stringify_cached(v, cache, &clength);\
+        EXPECT_EQ_SIZE_T(length, clength);\
+        EXPECT_TRUE(memcmp(json, cached, length) == 0);\
+        free(json);\
+    } while(0)
+
+static void test_stringify_cached() {
+    milo_value v;
+    milo_cache cache;
+    const char* first;
+    milo_value* a, *o;
+
+    milo_init(&v);
+    milo_cache_init(&cache);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "{\"n\":null,\"s\":\"abc\",\"a\":[1,2,[3,\"x\"]],\"o\":{\"1\":1,\"2\":{\"k\":true}}}"));
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    /* unchanged tree reuses the previous text */
+    first = cache.json;
+    EXPECT_TRUE(milo_stringify_cached(&v, &cache, NULL) == first);
+
+    a = milo_get_object_value(&v, 2);
+    milo_set_number(milo_get_array_element(milo_get_array_element(a, 2), 0), 4.5);
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    milo_set_string(milo_get_object_value(&v, 1), "a longer string\n", 16);
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    o = milo_get_object_value(&v, 3);
+    milo_set_boolean(milo_get_object_value(milo_get_object_value(o, 1), 0), 0);
+    milo_set_null(milo_get_array_element(a, 2));
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    milo_set_number(&v, 1.0);
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    /* recycled values drop their cached text */
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "[null,[1,2],{\"k\":\"v\"}]"));
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[null,[1,3],{\"k\":\"w\"}]", MILO_PARSE_OPT_RECYCLE));
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    /* packed arrays are cached whole; unpacking keeps their text */
+    milo_free(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "{\"p\":[1,2,3],\"q\":[4]}", MILO_PARSE_OPT_PACK_NUMBERS));
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+    milo_unpack_array(milo_get_object_value(&v, 0));
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+    milo_set_number(milo_get_array_element(milo_get_object_value(&v, 0), 1), 2.5);
+    EXPECT_CACHED_EQ_STRINGIFY(&v, &cache);
+
+    milo_free(&v);
+    milo_cache_free(&cache);
+}
+#endif
+
+typedef struct {
+    char* data;
+    size_t length, calls;
+} test_sink;
+
+static void test_sink_write(void* context, const char* data, size_t length) {
+    test_sink* sink = (test_sink*)context;
+    sink->data = (char*)realloc(sink->data, sink->length + length + 1);
+    memcpy(sink->data + sink->length, data, length);
+    sink->length += length;
+    sink->data[sink->length] = '\0';
+    sink->calls++;
+}
+
+#define TEST_FORMAT(expect, json, indent)\
+    do {\
+        test_sink sink = { NULL, 0, 0 };\
+        if ((indent) < 0)\
+            EXPECT_EQ_INT(MILO_PARSE_OK, milo_minify(json, strlen(json), test_sink_write, &sink, NULL));\
+        else\
+            EXPECT_EQ_INT(MILO_PARSE_OK, milo_prettify(json, strlen(json), (indent), test_sink_write, &sink, NULL));\
+        EXPECT_EQ_STRING(expect, sink.data, sink.length);\
+        free(sink.data);\
+    } while(0)
+
+static void test_stringify_format() {
+    const char* json = " { \"a\" : [ 1.50e+3 , -0 , true ] ,\n\t\"b\":{ } , \"c\" :[],\"d\":{\"e\":\"\\u00E9 x\"} } ";
+    test_sink sink = { NULL, 0, 0 };
+    size_t offset, i;
+    char* big;
+
+    TEST_FORMAT("{\"a\":[1.50e+3,-0,true],\"b\":{},\"c\":[],\"d\":{\"e\":\"\\u00E9 x\"}}", json, -1);
+    TEST_FORMAT("{\n  \"a\": [\n    1.50e+3,\n    -0,\n    true\n  ],\n  \"b\": {},\n  \"c\": [],\n  \"d\": {\n    \"e\": \"\\u00E9 x\"\n  }\n}", json, 2);
+    TEST_FORMAT("[\n1,\n[\n2\n]\n]", "[1,[2]]", 0);
+    TEST_FORMAT("\"s\"", "  \"s\"  ", 4);
+    TEST_FORMAT("null", "null", -1);
+
+    /* deep nesting needs more than one chunk of indentation */
+    TEST_FORMAT("[\n                                        []\n]", "[[]]", 40);
+
+    EXPECT_EQ_INT(MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, milo_minify("[1 2]", 5, test_sink_write, &sink, &offset));
+    EXPECT_EQ_SIZE_T(3, offset);
+    free(sink.data);
+
+    /* output larger than the internal buffer, long strings and whitespace runs */
+    big = (char*)malloc(40000);
+    big[0] = '[';
+    for (i = 1; i < 20000; i++)
+        big[i] = ' ';
+    big[i++] = '"';
+    for (; i < 39997; i++)
+        big[i] = 'x';
+    big[i++] = '"';
+    big[i++] = ',';
+    big[i++] = ']';
+    sink.data = NULL;
+    sink.length = sink.calls = 0;
+    EXPECT_EQ_INT(MILO_PARSE_INVALID_VALUE, milo_minify(big, 40000, test_sink_write, &sink, &offset));
+    EXPECT_EQ_SIZE_T(39999, offset);
+    big[39998] = ' ';
+    sink.length = sink.calls = 0;
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_minify(big, 40000, test_sink_write, &sink, NULL));
+    EXPECT_EQ_SIZE_T(20000, sink.length);
+    EXPECT_TRUE(sink.data[0] == '[' && sink.data[1] == '"' && sink.data[19998] == '"' && sink.data[19999] == ']');
+    free(sink.data);
+    free(big);
+}
+
 static void test_stringify() {
     TEST_ROUNDTRIP("null");
     TEST_ROUNDTRIP("false");
@@ -430,6 +1257,383 @@ static void test_stringify() {
     test_stringify_string();
     test_stringify_array();
     test_stringify_object();
+    test_stringify_to();
+    test_stringify_format();
+#ifdef MILO_HAS_IOV
+    test_stringify_iov();
+#endif
+#ifdef MILO_STRINGIFY_CACHE
+    test_stringify_cached();
+#endif
+}
+
+#define TEST_BINARY_ROUNDTRIP(json)\
+    do {\
+        milo_value v, v2;\
+        char* bin, *json2;\
+        size_t blength, length;\
+        milo_init(&v);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, json));\
+        bin = milo_encode_binary(&v, &blength);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_decode_binary(&v2, bin, blength));\
+        json2 = milo_stringify(&v2, &length);\
+        EXPECT_EQ_STRING(json, json2, length);\
+        milo_free(&v);\
+        milo_free(&v2);\
+        free(bin);\
+        free(json2);\
+    } while(0)
+
+#define TEST_BINARY_ERROR(error, bin)\
+    do {\
+        milo_value v;\
+        EXPECT_EQ_INT(error, milo_decode_binary(&v, bin, sizeof(bin) - 1));\
+        EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));\
+        milo_free(&v);\
+    } while(0)
+
+static void test_binary() {
+    TEST_BINARY_ROUNDTRIP("null");
+    TEST_BINARY_ROUNDTRIP("false");
+    TEST_BINARY_ROUNDTRIP("true");
+    TEST_BINARY_ROUNDTRIP("0");
+    TEST_BINARY_ROUNDTRIP("-0");
+    TEST_BINARY_ROUNDTRIP("30");
+    TEST_BINARY_ROUNDTRIP("31");
+    TEST_BINARY_ROUNDTRIP("-1");
+    TEST_BINARY_ROUNDTRIP("-32");
+    TEST_BINARY_ROUNDTRIP("123456789");
+    TEST_BINARY_ROUNDTRIP("-9007199254740991");
+    TEST_BINARY_ROUNDTRIP("9007199254740992");
+    TEST_BINARY_ROUNDTRIP("1.5");
+    TEST_BINARY_ROUNDTRIP("-1.7976931348623157e+308");
+    TEST_BINARY_ROUNDTRIP("\"\"");
+    TEST_BINARY_ROUNDTRIP("\"Hello\\u0000World\"");
+    TEST_BINARY_ROUNDTRIP("\"0123456789abcdefghijklmnopqrstuvwxyz\"");
+    TEST_BINARY_ROUNDTRIP("[]");
+    TEST_BINARY_ROUNDTRIP("[null,false,true,123,\"abc\",[1,2,3]]");
+    TEST_BINARY_ROUNDTRIP("{}");
+    TEST_BINARY_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+
+    {
+        static const char json[] = "{\"id\":12345,\"tags\":[\"a\",\"b\"],\"ok\":true,\"ratio\":0.25}";
+        milo_value v;
+        char* bin;
+        size_t blength;
+        milo_init(&v);
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, json));
+        bin = milo_encode_binary(&v, &blength);
+        EXPECT_TRUE(blength < sizeof(json) - 1);
+        milo_free(&v);
+        free(bin);
+    }
+
+    TEST_BINARY_ERROR(MILO_PARSE_EXPECT_VALUE, "");
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\x04");         /* unknown scalar */
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\xE0");         /* unknown kind */
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\x03\x00\x00"); /* truncated double */
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\x63" "ab");     /* truncated string */
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\x82\x00");      /* truncated array */
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\xA1\x01k");     /* missing member value */
+    TEST_BINARY_ERROR(MILO_PARSE_INVALID_VALUE, "\x3F\xFF");      /* truncated varint */
+    TEST_BINARY_ERROR(MILO_PARSE_ROOT_NOT_SINGULAR, "\x00\x00");
+}
+
+static void test_snapshot() {
+    static const char* path = "milo_test_snapshot.bin";
+    milo_value v;
+    milo_snapshot* s;
+    const milo_snapshot_value* r, *a, *o;
+    size_t i;
+
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v,
+        "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"e\":\"\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}"));
+    EXPECT_EQ_INT(0, milo_snapshot_write(&v, path));
+    milo_free(&v);
+
+    s = milo_snapshot_open(path);
+    EXPECT_TRUE(s != NULL);
+    if (s == NULL)
+        return;
+    r = milo_snapshot_root(s);
+    EXPECT_EQ_INT(MILO_OBJECT, milo_snapshot_get_type(r));
+    EXPECT_EQ_SIZE_T(8, milo_snapshot_get_object_size(r));
+    EXPECT_EQ_STRING("n", milo_snapshot_get_object_key(r, 0), milo_snapshot_get_object_key_length(r, 0));
+    EXPECT_EQ_INT(MILO_NULL, milo_snapshot_get_type(milo_snapshot_get_object_value(r, 0)));
+    EXPECT_FALSE(milo_snapshot_get_boolean(milo_snapshot_get_object_value(r, 1)));
+    EXPECT_TRUE(milo_snapshot_get_boolean(milo_snapshot_get_object_value(r, 2)));
+    EXPECT_EQ_DOUBLE(123.0, milo_snapshot_get_number(milo_snapshot_get_object_value(r, 3)));
+    EXPECT_EQ_STRING("abc", milo_snapshot_get_string(milo_snapshot_get_object_value(r, 4)), milo_snapshot_get_string_length(milo_snapshot_get_object_value(r, 4)));
+    EXPECT_EQ_STRING("", milo_snapshot_get_string(milo_snapshot_get_object_value(r, 5)), milo_snapshot_get_string_length(milo_snapshot_get_object_value(r, 5)));
+    a = milo_snapshot_get_object_value(r, 6);
+    EXPECT_EQ_SIZE_T(3, milo_snapshot_get_array_size(a));
+    for (i = 0; i < 3; i++)
+        EXPECT_EQ_DOUBLE(i + 1.0, milo_snapshot_get_number(milo_snapshot_get_array_element(a, i)));
+    o = milo_snapshot_get_object_value(r, 7);
+    EXPECT_EQ_SIZE_T(3, milo_snapshot_get_object_size(o));
+    for (i = 0; i < 3; i++) {
+        EXPECT_TRUE('1' + i == milo_snapshot_get_object_key(o, i)[0]);
+        EXPECT_EQ_DOUBLE(i + 1.0, milo_snapshot_get_number(milo_snapshot_get_object_value(o, i)));
+    }
+    milo_snapshot_close(s);
+    remove(path);
+
+    EXPECT_TRUE(milo_snapshot_open(path) == NULL);
+}
+
+static void test_doc() {
+    milo_value v;
+    milo_doc* d, *d2, *r;
+    milo_doc_slot slot;
+    const milo_value* root;
+    const double* numbers;
+    size_t length, count;
+
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "{\"a\":[1.50,2],\"s\":\"abc\"}", MILO_PARSE_OPT_LAZY_NUMBERS));
+    d = milo_doc_create(&v);
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    root = milo_doc_root(d);
+    EXPECT_EQ_INT(MILO_OBJECT, milo_get_type(root));
+    EXPECT_EQ_SIZE_T(2, milo_get_object_size(root));
+    EXPECT_EQ_DOUBLE(1.5, milo_get_number(milo_get_array_element(milo_get_object_value(root, 0), 0)));
+    EXPECT_TRUE(milo_get_number_lexeme(milo_get_array_element(milo_get_object_value(root, 0), 0), &length) != NULL);
+    EXPECT_TRUE(milo_doc_retain(d) == d);
+    milo_doc_release(d);
+
+    /* packed arrays stay packed, as reading them never writes */
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&v, "[[1,2],3]", MILO_PARSE_OPT_PACK_NUMBERS));
+    r = milo_doc_create(&v);
+    EXPECT_TRUE(milo_get_number_array(milo_get_array_element(milo_doc_root(r), 0), &numbers, &count));
+    EXPECT_EQ_DOUBLE(2.0, numbers[1]);
+    milo_doc_release(r);
+
+    milo_doc_slot_init(&slot, d);
+    milo_doc_release(d); /* the slot keeps the document alive */
+    r = milo_doc_slot_acquire(&slot);
+    EXPECT_TRUE(r == d);
+    EXPECT_EQ_STRING("abc", milo_get_string(milo_get_object_value(milo_doc_root(r), 1)), 3);
+
+    milo_init(&v);
+    milo_set_number(&v, 2.0);
+    d2 = milo_doc_create(&v);
+    milo_doc_slot_store(&slot, d2);
+    milo_doc_release(d2);
+    /* the old version stays readable until its last reader lets go */
+    EXPECT_EQ_INT(MILO_OBJECT, milo_get_type(milo_doc_root(r)));
+    milo_doc_release(r);
+    r = milo_doc_slot_acquire(&slot);
+    EXPECT_EQ_DOUBLE(2.0, milo_get_number(milo_doc_root(r)));
+    milo_doc_release(r);
+
+    milo_doc_slot_store(&slot, NULL);
+    EXPECT_TRUE(milo_doc_slot_acquire(&slot) == NULL);
+    milo_doc_slot_free(&slot);
+}
+
+#ifdef TEST_THREADS
+#define TEST_DOC_VERSIONS 200
+
+typedef struct {
+    milo_doc_slot* slot;
+    int failed;
+} test_doc_reader;
+
+/* Reads until the last version shows up; versions must never go back */
+static void* test_doc_reader_thread(void* arg) {
+    test_doc_reader* r = (test_doc_reader*)arg;
+    double seen = 0.0;
+    while (seen != TEST_DOC_VERSIONS - 1) {
+        milo_doc* d = milo_doc_slot_acquire(r->slot);
+        const milo_value* root = d != NULL ? milo_doc_root(d) : NULL;
+        if (root == NULL || milo_get_type(root) != MILO_NUMBER || milo_get_number(root) < seen) {
+            r->failed++;
+            milo_doc_release(d);
+            break;
+        }
+        seen = milo_get_number(root);
+        milo_doc_release(d);
+    }
+    return NULL;
+}
+
+static void test_doc_threads() {
+    milo_doc* docs[TEST_DOC_VERSIONS];
+    milo_doc_slot slot;
+    test_doc_reader readers[4];
+    pthread_t threads[4];
+    milo_value v;
+    int i;
+    for (i = 0; i < TEST_DOC_VERSIONS; i++) {
+        milo_init(&v);
+        milo_set_number(&v, i);
+        docs[i] = milo_doc_create(&v);
+    }
+    milo_doc_slot_init(&slot, docs[0]);
+    for (i = 0; i < 4; i++) {
+        readers[i].slot = &slot;
+        readers[i].failed = 0;
+        EXPECT_EQ_INT(0, pthread_create(&threads[i], NULL, test_doc_reader_thread, &readers[i]));
+    }
+    for (i = 1; i < TEST_DOC_VERSIONS; i++)
+        milo_doc_slot_store(&slot, docs[i]);
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ_INT(0, readers[i].failed);
+    }
+    /* every reader reference is gone; only the slot still holds the last version */
+    for (i = 0; i < TEST_DOC_VERSIONS; i++)
+        EXPECT_EQ_SIZE_T((i == TEST_DOC_VERSIONS - 1 ? 2 : 1), milo_doc_refs(docs[i]));
+    milo_doc_slot_free(&slot);
+    for (i = 0; i < TEST_DOC_VERSIONS; i++) {
+        EXPECT_EQ_SIZE_T(1, milo_doc_refs(docs[i]));
+        milo_doc_release(docs[i]);
+    }
+}
+#endif
+
+#ifdef TEST_THREADS
+static void* test_free_deferred_thread(void* arg) {
+    int i, *failed = (int*)arg;
+    for (i = 0; i < 500; i++) {
+        milo_value v;
+        milo_init(&v);
+        if (milo_parse(&v, "[{\"a\":[1,2,3]},\"b\",[null]]") != MILO_PARSE_OK)
+            ++*failed;
+        milo_free_deferred(&v);
+        if (milo_get_type(&v) != MILO_NULL)
+            ++*failed;
+    }
+    return NULL;
+}
+
+static void* test_flush_thread(void* arg) {
+    int i;
+    (void)arg;
+    for (i = 0; i < 50; i++)
+        milo_reclaimer_flush();
+    return NULL;
+}
+#endif
+
+static void test_free_deferred() {
+    milo_value v;
+    int i;
+#ifdef TEST_THREADS
+    pthread_t threads[4], flusher;
+    int failed[4] = { 0, 0, 0, 0 };
+#endif
+    for (i = 0; i < 200; i++) { /* more than the queue holds, so the caller waits for free slots */
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "{\"a\":[1,\"two\",{\"b\":[null,true]}],\"c\":\"d\"}"));
+        milo_free_deferred(&v);
+        EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    }
+    milo_reclaimer_flush();
+    milo_reclaimer_flush();
+
+    /* scalars, strings and a restarted reclaimer */
+    milo_init(&v);
+    milo_set_string(&v, "abc", 3);
+    milo_free_deferred(&v);
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "[[],{}]"));
+    milo_free_deferred(&v);
+    EXPECT_EQ_INT(MILO_NULL, milo_get_type(&v));
+    milo_reclaimer_flush();
+
+#ifdef TEST_THREADS
+    /* producers racing with concurrent flushes; trees queued while stopping would leak */
+    for (i = 0; i < 4; i++)
+        EXPECT_EQ_INT(0, pthread_create(&threads[i], NULL, test_free_deferred_thread, &failed[i]));
+    EXPECT_EQ_INT(0, pthread_create(&flusher, NULL, test_flush_thread, NULL));
+    for (i = 0; i < 50; i++)
+        milo_reclaimer_flush();
+    pthread_join(flusher, NULL);
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        EXPECT_EQ_INT(0, failed[i]);
+    }
+    milo_reclaimer_flush();
+#endif
+}
+
+#define TEST_EQUAL(expect, json1, json2, flags)\
+    do {\
+        milo_value a, b;\
+        milo_init(&a);\
+        milo_init(&b);\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&a, json1));\
+        EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse_ex(&b, json2, MILO_PARSE_OPT_LAZY_NUMBERS | MILO_PARSE_OPT_PACK_NUMBERS));\
+        EXPECT_EQ_INT(expect, milo_equal(&a, &b, flags));\
+        EXPECT_EQ_INT(expect, milo_equal(&b, &a, flags));\
+        if (expect)\
+            EXPECT_TRUE(milo_hash(&a) == milo_hash(&b));\
+        milo_free(&a);\
+        milo_free(&b);\
+    } while(0)
+
+static void test_equal() {
+    milo_value v, w;
+    char a[2048], b[2048];
+    size_t i, la = 1, lb = 1;
+
+    TEST_EQUAL(1, "null", "null", 0);
+    TEST_EQUAL(0, "null", "false", 0);
+    TEST_EQUAL(0, "true", "false", 0);
+    TEST_EQUAL(1, "1.5", "15e-1", 0);
+    TEST_EQUAL(1, "0", "-0", 0);
+    TEST_EQUAL(0, "1", "\"1\"", 0);
+    TEST_EQUAL(1, "\"a\\u0000b\"", "\"a\\u0000b\"", 0);
+    TEST_EQUAL(0, "\"a\\u0000b\"", "\"a\\u0000c\"", 0);
+    TEST_EQUAL(0, "\"abc\"", "\"abcd\"", 0);
+    TEST_EQUAL(1, "[1,2,3]", "[1,2,3.0]", 0);
+    TEST_EQUAL(0, "[1,2,3]", "[1,3,2]", 0);
+    TEST_EQUAL(0, "[1,2]", "[1,2,3]", 0);
+    TEST_EQUAL(1, "[1,\"a\",[0]]", "[1,\"a\",[-0]]", 0);
+    TEST_EQUAL(0, "[1,\"a\"]", "[1,2]", 0);
+    TEST_EQUAL(1, "{}", "{}", 0);
+    TEST_EQUAL(1, "{\"a\":1,\"b\":[2]}", "{\"b\":[2],\"a\":1}", 0);
+    TEST_EQUAL(0, "{\"a\":1,\"b\":[2]}", "{\"b\":[2],\"a\":1}", MILO_EQUAL_KEY_ORDER);
+    TEST_EQUAL(1, "{\"a\":1,\"b\":[2]}", "{\"a\":1,\"b\":[2]}", MILO_EQUAL_KEY_ORDER);
+    TEST_EQUAL(0, "{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":2}", 0);
+    TEST_EQUAL(0, "{\"a\":1}", "{\"a\":1,\"b\":2}", 0);
+    TEST_EQUAL(1, "{\"o\":{\"x\":1,\"y\":2},\"p\":0}", "{\"p\":0,\"o\":{\"y\":2,\"x\":1}}", 0);
+    TEST_EQUAL(0, "{\"o\":{\"x\":1,\"y\":2},\"p\":0}", "{\"p\":0,\"o\":{\"y\":2,\"x\":1}}", MILO_EQUAL_KEY_ORDER);
+
+    /* Duplicate keys compare as multisets */
+    TEST_EQUAL(1, "{\"x\":1,\"x\":2,\"x\":1}", "{\"x\":2,\"x\":1,\"x\":1}", 0);
+    TEST_EQUAL(0, "{\"x\":1,\"x\":1,\"x\":2}", "{\"x\":1,\"x\":2,\"x\":2}", 0);
+
+    /* More members out of order than fit the local marks */
+    a[0] = b[0] = '{';
+    for (i = 0; i < 100; i++) {
+        la += sprintf(a + la, "%s\"k%u\":%u", i ? "," : "", (unsigned)i, (unsigned)i);
+        lb += sprintf(b + lb, "%s\"k%u\":%u", i ? "," : "", (unsigned)(99 - i), (unsigned)(99 - i));
+    }
+    a[la++] = b[lb++] = '}';
+    a[la] = b[lb] = '\0';
+    milo_init(&v);
+    milo_init(&w);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, a));
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&w, b));
+    EXPECT_TRUE(milo_equal(&v, &w, 0));
+    EXPECT_FALSE(milo_equal(&v, &w, MILO_EQUAL_KEY_ORDER));
+    EXPECT_TRUE(milo_hash(&v) == milo_hash(&w));
+    milo_set_number(milo_get_object_value(&w, 0), 100.0);
+    EXPECT_FALSE(milo_equal(&v, &w, 0));
+    milo_free(&v);
+    milo_free(&w);
+
+    /* Hashes tell kinds and orders apart */
+    milo_init(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "[[1,2],[2,1],{\"a\":\"b\"},{\"b\":\"a\"},\"\",0,null,false,[]]"));
+    for (i = 0; i < 9; i++) {
+        size_t j;
+        for (j = i + 1; j < 9; j++)
+            EXPECT_TRUE(milo_hash(milo_get_array_element(&v, i)) != milo_hash(milo_get_array_element(&v, j)));
+    }
+    milo_free(&v);
 }
 
 static void test_access_null() {
@@ -471,7 +1675,27 @@ static void test_access_string() {
     milo_free(&v);
 }
 
+#ifdef MILO_COMPACT
+static void test_access_compact() {
+    milo_value v;
+    milo_value e[2];
+    EXPECT_TRUE(sizeof(milo_value) <= 2 * sizeof(double));
+    milo_init(&v);
+    milo_set_string(&v, "abc", 3);
+    EXPECT_EQ_SIZE_T(3, milo_get_string_length(&v));
+    milo_free(&v);
+    EXPECT_EQ_INT(MILO_PARSE_OK, milo_parse(&v, "[[1,2],{\"a\":true}]"));
+    memcpy(e, milo_get_array_element(&v, 0), sizeof(e));
+    EXPECT_EQ_SIZE_T(2, milo_get_array_size(&e[0]));
+    EXPECT_EQ_SIZE_T(1, milo_get_object_size(&e[1]));
+    milo_free(&v);
+}
+#endif
+
 static void test_access() {
+#ifdef MILO_COMPACT
+    test_access_compact();
+#endif
     test_access_null();
     test_access_boolean();
     test_access_number();
@@ -484,6 +1708,14 @@ int main() {
 #endif
     test_parse();
     test_stringify();
+    test_binary();
+    test_snapshot();
+    test_doc();
+#ifdef TEST_THREADS
+    test_doc_threads();
+#endif
+    test_free_deferred();
+    test_equal();
     test_access();
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;
@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "milo.hpp"
+
+/* AddressSanitizer moves every reallocation */
+#if defined(__has_feature)
+#define MILO_TEST_HAS_ASAN __has_feature(address_sanitizer)
+#else
+#define MILO_TEST_HAS_ASAN 0
+#endif
+
+static int main_ret = 0;
+static int test_count = 0;
+static int test_pass = 0;
+
+#define EXPECT_TRUE(actual) \
+    do {\
+        test_count++;\
+        if (actual)\
+            test_pass++;\
+        else {\
+            std::fprintf(stderr, "%s:%d: expect: %s\n", __FILE__, __LINE__, #actual);\
+            main_ret = 1;\
+        }\
+    } while(0)
+
+static_assert(!std::is_copy_constructible_v<milo::document>, "document must be move-only");
+static_assert(std::is_nothrow_move_constructible_v<milo::document>, "document moves must be noexcept");
+static_assert(std::is_nothrow_move_assignable_v<milo::document>, "document moves must be noexcept");
+static_assert(sizeof(milo::value_ref) == sizeof(const milo_value*), "value_ref must be a bare pointer");
+
+static void test_document() {
+    milo::document d;
+    EXPECT_TRUE(d.root().is_null());
+    EXPECT_TRUE(d.parse("{\"a\":[1,true,\"x\\u0000y\"],\"b\":{}}") == MILO_PARSE_OK);
+    EXPECT_TRUE(d.root().is_object());
+
+    milo::document e(std::move(d));
+    EXPECT_TRUE(d.root().is_null());
+    EXPECT_TRUE(e.root().member_count() == 2);
+
+    d = std::move(e);
+    EXPECT_TRUE(e.root().is_null());
+    EXPECT_TRUE(d.root().key(1) == "b");
+
+    EXPECT_TRUE(d.parse("[1") == MILO_PARSE_MISS_COMMA_OR_SQUARE_BRACKET);
+    EXPECT_TRUE(d.root().is_null());
+}
+
+static void test_document_recycle() {
+    milo::document d;
+    EXPECT_TRUE(d.parse("{\"id\":1,\"tags\":[\"x\",\"y\"]}", MILO_PARSE_OPT_RECYCLE) == MILO_PARSE_OK);
+    const char* key = milo_get_object_key(d.c_value(), 0);
+    const char* tag = d.root().value(1)[0].get_string().data();
+    EXPECT_TRUE(d.parse("{\"id\":2,\"tags\":[\"z\",\"w\"]}", MILO_PARSE_OPT_RECYCLE) == MILO_PARSE_OK);
+    EXPECT_TRUE(d.root().value(0).get<int>() == 2);
+    EXPECT_TRUE(d.root().key(1) == "tags");
+    EXPECT_TRUE(d.root().value(1)[0].get<std::string_view>() == "z");
+    EXPECT_TRUE(d.root().value(1)[1].get<std::string_view>() == "w");
+#if !defined(__SANITIZE_ADDRESS__) && !MILO_TEST_HAS_ASAN
+    /* same-sized strings are reallocated in place rather than freed and allocated again */
+    EXPECT_TRUE(milo_get_object_key(d.c_value(), 0) == key);
+    EXPECT_TRUE(d.root().value(1)[0].get_string().data() == tag);
+#else
+    (void)key;
+    (void)tag;
+#endif
+
+    EXPECT_TRUE(d.parse("{\"id\":3,\"tags\":[}", MILO_PARSE_OPT_RECYCLE) == MILO_PARSE_INVALID_VALUE);
+    EXPECT_TRUE(d.root().is_null());
+    EXPECT_TRUE(d.parse("[1]", MILO_PARSE_OPT_RECYCLE) == MILO_PARSE_OK);
+    EXPECT_TRUE(d.root()[0].get<int>() == 1);
+}
+
+static void test_value_ref() {
+    milo::document d;
+    d.parse("{\"n\":2.5,\"t\":true,\"s\":\"x\\u0000y\",\"a\":[1,2,3]}");
+    milo::value_ref r = d.root();
+    EXPECT_TRUE(r.value(0).get<double>() == 2.5);
+    EXPECT_TRUE(r.value(0).get<int>() == 2);
+    EXPECT_TRUE(r.value(1).get<bool>());
+    EXPECT_TRUE(r.value(2).get<std::string_view>() == std::string_view("x\0y", 3));
+    EXPECT_TRUE(r.value(3).get<milo::value_ref>().size() == 3);
+    EXPECT_TRUE(r.value(3)[2].get<int>() == 3);
+    EXPECT_TRUE(r.value(2).get_string().data() == milo_get_string(r.value(2).c_value()));
+}
+
+static void test_iterators() {
+    milo::document d;
+    int sum = 0;
+    std::size_t klen = 0;
+    d.parse("{\"a\":[1,2,3],\"bc\":[],\"d\":[4]}");
+    for (milo::member m : d.root().members()) {
+        klen += m.key.size();
+        for (milo::value_ref e : m.value().elements())
+            sum += e.get<int>();
+    }
+    EXPECT_TRUE(klen == 4);
+    EXPECT_TRUE(sum == 10);
+
+    d.parse("[1,2.5,4]", MILO_PARSE_OPT_PACK_NUMBERS);
+    double total = 0;
+    EXPECT_TRUE(d.root().is_packed());
+    for (double n : d.root().numbers())
+        total += n;
+    EXPECT_TRUE(total == 7.5);
+    milo_unpack_array(d.c_value());
+    EXPECT_TRUE(!d.root().is_packed() && d.root().numbers().begin() == d.root().numbers().end());
+    EXPECT_TRUE(d.root()[1].get<double>() == 2.5);
+}
+
+#if __cplusplus >= 202002L
+using static_config = milo::static_document<R"(
+    {"name":"milo","retries":3,"ratio":0.125,"tags":["a","\u00e9\ud834\udd1e",[]],
+     "limits":{"min":-0,"max":1e22,"eps":1e-6},"on":true,"off":false,"none":null,"":{}}
+)">;
+
+static_assert(static_config::root().c_value() == static_config::c_value(), "root is usable in constant expressions");
+
+/* Same text as parsing the literal at runtime */
+static bool same_as_runtime(const milo_value* v, const char* json) {
+    milo_value w;
+    char* a, *b;
+    std::size_t alen, blen;
+    bool same;
+    milo_init(&w);
+    if (milo_parse(&w, json) != MILO_PARSE_OK)
+        return false;
+    a = milo_stringify(v, &alen);
+    b = milo_stringify(&w, &blen);
+    same = alen == blen && std::memcmp(a, b, alen) == 0;
+    std::free(a);
+    std::free(b);
+    milo_free(&w);
+    return same;
+}
+
+static void test_static_document() {
+    milo::value_ref r = static_config::root();
+    EXPECT_TRUE(r.is_object());
+    EXPECT_TRUE(r.member_count() == 9);
+    EXPECT_TRUE(r.value(0).get_string() == "milo");
+    EXPECT_TRUE(r.value(0).get_string().data()[4] == '\0');
+    EXPECT_TRUE(r.value(1).get<int>() == 3);
+    EXPECT_TRUE(r.value(2).get<double>() == 0.125);
+    EXPECT_TRUE(r.value(3).size() == 3);
+    EXPECT_TRUE(r.value(3)[1].get_string() == "\xC3\xA9\xF0\x9D\x84\x9E");
+    EXPECT_TRUE(r.value(3)[2].size() == 0);
+    EXPECT_TRUE(r.key(8).empty() && r.value(8).member_count() == 0);
+    EXPECT_TRUE(r.value(5).get_boolean() && !r.value(6).get_boolean() && r.value(7).is_null());
+    EXPECT_TRUE(same_as_runtime(static_config::c_value(),
+        "{\"name\":\"milo\",\"retries\":3,\"ratio\":0.125,\"tags\":[\"a\",\"\\u00e9\\ud834\\udd1e\",[]],"
+        "\"limits\":{\"min\":-0,\"max\":1e22,\"eps\":1e-6},\"on\":true,\"off\":false,\"none\":null,\"\":{}}"));
+    EXPECT_TRUE(same_as_runtime(milo::static_document<" 0.1 ">::c_value(), "0.1"));
+    EXPECT_TRUE(same_as_runtime(milo::static_document<"[[[]],-12.5e-3,900719925474099.1]">::c_value(),
+        "[[[]],-12.5e-3,900719925474099.1]"));
+}
+#endif
+
+int main() {
+    test_document();
+    test_document_recycle();
+    test_value_ref();
+    test_iterators();
+#if __cplusplus >= 202002L
+    test_static_document();
+#endif
+    std::printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
+    return main_ret;
+}